@@ -37,6 +37,7 @@ ClassDecl::ClassDecl(Identifier *n, NamedType *ex, List<NamedType*> *imp, List<D
 	self -> SetParent(this);
 	CompList = new List<NamedType*>;
 	methodLabels = new List<const char*>;
+	subclasses = new List<ClassDecl*>;
 }
 
 int ClassDecl::DeployMems(){
@@ -102,6 +103,23 @@ int ClassDecl::DeployMems(){
 	return varEnum+4;
 }
 
+/* Method: FinalMethodLabel
+ * -------------------------
+ * Class hierarchy analysis: the label of the method at offset in the
+ * vtable if this class and all classes extending it, directly or not,
+ * have the same one there, else NULL. The whole program is compiled
+ * at once, so a call to such a method can go straight to its label.
+ */
+const char* ClassDecl::FinalMethodLabel(int offset){
+	const char *label = methodLabels->Nth(offset/4);
+	for(int i = 0; i< subclasses->NumElements(); i++){
+		const char *sub = subclasses->Nth(i)->FinalMethodLabel(offset);
+		if(sub == NULL || strcmp(sub,label)!=0)
+			return NULL;
+	}
+	return label;
+}
+
 void ClassDecl::Emit(){
 	Assert(nodeTable);
 	FnDecl * fn = NULL; 
@@ -125,6 +143,7 @@ SymbolTable* ClassDecl::ConsTable(){
 		ClassDecl *ext = dynamic_cast<ClassDecl*>(parent->Lookup(extends->getid(),false));
 		if(ext) {
 			nodeTable->appendTable(ext->ConsTable());
+			ext->subclasses->Append(this);
 		}
 		else{
 			ReportError::IdentifierNotDeclared(extends->getid(), LookingForClass);
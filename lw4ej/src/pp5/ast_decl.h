@@ -62,6 +62,7 @@ class ClassDecl : public Decl
 	NamedType* self;
 	List<NamedType*> *CompList;
 	List<const char*> *methodLabels;
+	List<ClassDecl*> *subclasses;
 	int size;
 
   public:
@@ -70,6 +71,7 @@ class ClassDecl : public Decl
 	NamedType* getself(){return self;}
 	List<NamedType*> * getCompatList(){return CompList;}
 	List<const char*> *getMethodLabels(){return methodLabels;}
+	const char *FinalMethodLabel(int offset);
 	SymbolTable *ConsTable();
 	SymbolTable *GetNodeTable(){return nodeTable;}
 	void Check();
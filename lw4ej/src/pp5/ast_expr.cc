@@ -8,6 +8,7 @@
 #include "ast_stmt.h"
 #include <string.h>
 #include "errors.h"
+#include "passmanager.h"
 
 IntConstant::IntConstant(yyltype loc, int val) : Expr(loc) {
     value = val;
@@ -279,6 +280,20 @@ void RelationalExpr::Emit(){
 	}
 }
 
+void RelationalExpr::EmitBranch(const char *label, bool onTrue){
+	if(GetOptimizationLevel() == 0){
+		Expr::EmitBranch(label, onTrue);
+		return;
+	}
+	Assert(parent);
+	codegen = parent->GetGenerator();
+	left->Emit();
+	right->Emit();
+	IfCmp::Relation rel = IfCmp::RelationForName(op->op());
+	if(!onTrue) rel = IfCmp::Negate(rel);
+	codegen->GenIfCmp(rel, left->GetAddr(), right->GetAddr(), label);
+}
+
 Type* EqualityExpr::ExprType(){
 	if( Etype != NULL )
 		return Etype;
@@ -334,6 +349,21 @@ void EqualityExpr::Emit(){
 	}
 }
 
+void EqualityExpr::EmitBranch(const char *label, bool onTrue){
+	if(GetOptimizationLevel() == 0
+	   || left->ExprType()->IsEquivalentTo(Type::stringType)){
+		Expr::EmitBranch(label, onTrue);
+		return;
+	}
+	Assert(parent);
+	codegen = parent->GetGenerator();
+	left->Emit();
+	right->Emit();
+	IfCmp::Relation rel = IfCmp::RelationForName(op->op());
+	if(!onTrue) rel = IfCmp::Negate(rel);
+	codegen->GenIfCmp(rel, left->GetAddr(), right->GetAddr(), label);
+}
+
 Type* LogicalExpr::ExprType(){
 	if( Etype != NULL )
 		return Etype;
@@ -376,9 +406,15 @@ void LogicalExpr::Emit(){
 	codegen = parent->GetGenerator();
 	char* opName = op->op();
 	if(left){
-		left->Emit();
-		right->Emit();
-		MemAddr = codegen->GenBinaryOp(opName,left->GetAddr(),right->GetAddr());
+		// && and || only evaluate the right operand when the left
+		// doesn't decide the result, so they are done as branches
+		// setting the result to 0 or 1
+		char *endLabel = codegen->NewLabel();
+		MemAddr = codegen->GenTempVar();
+		codegen->GenAssign(MemAddr, codegen->GenLoadConstant(0));
+		EmitBranch(endLabel, false);
+		codegen->GenAssign(MemAddr, codegen->GenLoadConstant(1));
+		codegen->GenLabel(endLabel);
 	}
 	else{
 		right->Emit();
@@ -389,6 +425,31 @@ void LogicalExpr::Emit(){
 	
 }
 
+void LogicalExpr::EmitBranch(const char *label, bool onTrue){
+	Assert(parent);
+	codegen = parent->GetGenerator();
+	char* opName = op->op();
+	if(!left){
+		Assert(strcmp(opName, "!")==0);
+		right->EmitBranch(label, !onTrue);
+		return;
+	}
+	// a && b is false as soon as a is, a || b true as soon as a is.
+	// If that is the outcome we branch on, both operands can jump to
+	// label, otherwise the left one skips the right when it decides.
+	bool isAnd = (strcmp(opName, "&&")==0);
+	if(onTrue != isAnd){
+		left->EmitBranch(label, onTrue);
+		right->EmitBranch(label, onTrue);
+	}
+	else{
+		char *skipLabel = codegen->NewLabel();
+		left->EmitBranch(skipLabel, !onTrue);
+		right->EmitBranch(label, onTrue);
+		codegen->GenLabel(skipLabel);
+	}
+}
+
 ArrayAccess::ArrayAccess(yyltype loc, Expr *b, Expr *s) : LValue(loc) {
     (base=b)->SetParent(this); 
     (subscript=s)->SetParent(this);
@@ -426,22 +487,29 @@ Location* ArrayAccess::TargetElem(){
 	base->Emit();
 	subscript->Emit();
 	Location * index = subscript->GetAddr();
-	Location * zero = codegen->GenLoadConstant(0);
-	Location * l = codegen->GenBinaryOp("<", index, zero);
-	Location * len = codegen->GenLoad(base->GetAddr(), -4);
-	Location * r0 = codegen->GenBinaryOp("<", index, len);
-	Location * r = codegen->GenBinaryOp("==", r0, zero);
-	Location * test = codegen->GenBinaryOp("||", l, r);
+	if(GetOptimizationLevel() > 0){
+		Location * len = codegen->GenLoad(base->GetAddr(), -4);
+		codegen->GenBoundsCheck(index, len);
+	}else{
+		Location * zero = codegen->GenLoadConstant(0);
+		Location * l = codegen->GenBinaryOp("<", index, zero);
+		Location * len = codegen->GenLoad(base->GetAddr(), -4);
+		Location * r0 = codegen->GenBinaryOp("<", index, len);
+		Location * r = codegen->GenBinaryOp("==", r0, zero);
+		Location * test = codegen->GenBinaryOp("||", l, r);
 	
-	char* label = codegen->NewLabel();
-	codegen->GenIfZ(test,label);
-	Location * errinfo = codegen->GenLoadConstant(err_arr_out_of_bounds);
-	codegen->GenBuiltInCall(PrintString, errinfo, NULL);	
-	codegen->GenBuiltInCall(Halt,NULL,NULL);
-	codegen->GenLabel(label);
+		char* label = codegen->NewLabel();
+		codegen->GenIfZ(test,label);
+		Location * errinfo = codegen->GenLoadConstant(err_arr_out_of_bounds);
+		codegen->GenBuiltInCall(PrintString, errinfo, NULL);	
+		codegen->GenBuiltInCall(Halt,NULL,NULL);
+		codegen->GenLabel(label);
+	}
 	Location * size = codegen->GenLoadConstant(4);
 	Location * offset = codegen->GenBinaryOp("*", size, index);
-	Location * addr = codegen->GenBinaryOp("+", base->GetAddr(),offset);
+	//in range once checked, so the address can't overflow
+	const char * add = (GetOptimizationLevel() > 0) ? "+u" : "+";
+	Location * addr = codegen->GenBinaryOp(add, base->GetAddr(),offset);
 	return addr;
 }
 
@@ -485,6 +553,16 @@ ClassDecl* Expr:: FindClass(){
 	return NULL;
 }
 
+void Expr::EmitBranch(const char *label, bool onTrue){
+	Assert(parent);
+	Emit();
+	codegen = parent->GetGenerator();
+	if(onTrue)
+		codegen->GenIfCmp(IfCmp::Ne, MemAddr, codegen->GenLoadConstant(0), label);
+	else
+		codegen->GenIfZ(MemAddr, label);
+}
+
 void This::Emit(){
 	MemAddr = CodeGenerator::ThisPtr;
 }
@@ -738,12 +816,20 @@ void Call::Emit(){
 		bool isreturnType = (fn->GetRtype() == Type::voidType)?false:true;
 		Emit_Actuals();
 
-		Location* tmp0 = codegen->GenLoad(CodeGenerator::ThisPtr,0);//vtable
-		Location* f = codegen->GenLoad(tmp0, fn->GetOffset());
+		const char *target = NULL;
+		if(PassManager::IsEnabled("devirtualize"))//not overridden: call it directly
+			target = cls->FinalMethodLabel(fn->GetOffset());
+		Location* f = NULL;
+		if(target == NULL){
+			Location* tmp0 = codegen->GenLoad(CodeGenerator::ThisPtr,0);//vtable
+			f = codegen->GenLoad(tmp0, fn->GetOffset());
+		}
 		Push_Actuals();
 		codegen->GenPushParam(CodeGenerator::ThisPtr);
 
-		if(isreturnType)
+		if(target)
+			MemAddr = codegen->GenLCall(target, isreturnType);
+		else if(isreturnType)
 			MemAddr = codegen->GenACall(f, isreturnType);
 		else 
 			codegen->GenACall(f, false);
@@ -770,11 +856,20 @@ void Call::Emit(){
 			Emit_Actuals();
 			base->Emit();
 			Assert(base->GetAddr()!=NULL);
-			Location * tmp0 = codegen->GenLoad(base->GetAddr(),0); //load vtable
-			Location * tmp1 = codegen->GenLoad(tmp0, fn->GetOffset());
+			const char *target = NULL;
+			if(PassManager::IsEnabled("devirtualize"))
+				target = tyclass->FinalMethodLabel(fn->GetOffset());
+			Location * tmp1 = NULL;
+			if(target == NULL){
+				Location * tmp0 = codegen->GenLoad(base->GetAddr(),0); //load vtable
+				tmp1 = codegen->GenLoad(tmp0, fn->GetOffset());
+			}
+			else codegen->GenNullCheck(base->GetAddr());//still fault on a null object
 			Push_Actuals();	
 			codegen->GenPushParam(base->GetAddr());
-			if(isreturnType)
+			if(target)
+				MemAddr = codegen->GenLCall(target, isreturnType);
+			else if(isreturnType)
 				MemAddr = codegen->GenACall(tmp1, isreturnType);
 			else
 				codegen->GenACall(tmp1, isreturnType);
@@ -846,16 +941,22 @@ void NewArrayExpr::Emit(){
 	Assert(parent);
 	codegen = parent->GetGenerator();
  
-	char * tplabel = codegen->NewLabel();
-	
+	char * tplabel = NULL;
+	if(GetOptimizationLevel() == 0)//numbered before any label in size
+		tplabel = codegen->NewLabel();
+
 	size->Emit();
-	Location * tmp0 = codegen->GenLoadConstant(0);
-	Location * tmp1 = codegen->GenBinaryOp("<", size->GetAddr(), tmp0);
-	codegen->GenIfZ(tmp1, tplabel);
-	Location * tmp2 = codegen->GenLoadConstant(err_arr_bad_size);
-	codegen->GenBuiltInCall(PrintString, tmp2, NULL);
-	codegen->GenBuiltInCall(Halt, NULL, NULL);
-	codegen->GenLabel(tplabel);
+	if(GetOptimizationLevel() > 0){
+		codegen->GenSizeCheck(size->GetAddr());
+	}else{
+		Location * tmp0 = codegen->GenLoadConstant(0);
+		Location * tmp1 = codegen->GenBinaryOp("<", size->GetAddr(), tmp0);
+		codegen->GenIfZ(tmp1, tplabel);
+		Location * tmp2 = codegen->GenLoadConstant(err_arr_bad_size);
+		codegen->GenBuiltInCall(PrintString, tmp2, NULL);
+		codegen->GenBuiltInCall(Halt, NULL, NULL);
+		codegen->GenLabel(tplabel);
+	}
 	
 	Location * tmp3 = codegen->GenLoadConstant(1);
 	Location * tmp4 = codegen->GenBinaryOp("+", tmp3, size->GetAddr());
@@ -863,7 +964,8 @@ void NewArrayExpr::Emit(){
 	Location * tmp6 = codegen->GenBinaryOp("*", tmp4, tmp5);
 	Location * tmp7 = codegen->GenBuiltInCall(Alloc, tmp6, NULL);
 	codegen->GenStore(tmp7,size->GetAddr(),0);
-	MemAddr = codegen->GenBinaryOp("+", tmp7, tmp5);
+	const char * add = (GetOptimizationLevel() > 0) ? "+u" : "+";//an address
+	MemAddr = codegen->GenBinaryOp(add, tmp7, tmp5);
 }
 
 void ReadIntegerExpr::Emit(){
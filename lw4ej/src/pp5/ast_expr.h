@@ -34,6 +34,12 @@ class Expr : public Stmt
 	ClassDecl* FindClass();
 	virtual Type* ExprType(){return NULL;}
 	Location *GetAddr(){return MemAddr;}
+
+	// Emits the expression as a test, jumping to label if its value
+	// is onTrue and falling through otherwise. By default the value
+	// is computed and tested, comparisons override this to branch on
+	// the comparison directly.
+	virtual void EmitBranch(const char *label, bool onTrue);
 };
 
 /* This node type is used for those places where an expression is optional.
@@ -135,6 +141,7 @@ class RelationalExpr : public CompoundExpr
 	Type* ExprType();
 	void Check();
 	void Emit();
+	void EmitBranch(const char *label, bool onTrue);
 };
 
 class EqualityExpr : public CompoundExpr 
@@ -145,6 +152,7 @@ class EqualityExpr : public CompoundExpr
 	Type* ExprType();
 	void Check();
 	void Emit();
+	void EmitBranch(const char *label, bool onTrue);
 };
 
 class LogicalExpr : public CompoundExpr 
@@ -156,6 +164,7 @@ class LogicalExpr : public CompoundExpr
 	Type* ExprType();
 	void Check();
 	void Emit();
+	void EmitBranch(const char *label, bool onTrue);
 };
 
 class AssignExpr : public CompoundExpr 
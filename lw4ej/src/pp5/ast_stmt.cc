@@ -138,10 +138,9 @@ void WhileStmt::Emit(){
 
 	tplabel1=codegen->NewLabel();
 	codegen->GenLabel(tplabel1);
-	test->Emit();
 	tplabel2=codegen->NewLabel();
 	endLabel=tplabel2; 
-	codegen->GenIfZ( test->GetAddr(), tplabel2);
+	test->EmitBranch(tplabel2, false);
 	body->Emit();
 	codegen->GenGoto(tplabel1);
 	codegen->GenLabel(tplabel2);
@@ -176,8 +175,7 @@ void ForStmt::Emit(){
 	
 	init->Emit();
 	codegen->GenLabel(tplabel1);
-	test->Emit();
-	codegen->GenIfZ( test->GetAddr(), tplabel2);
+	test->EmitBranch(tplabel2, false);
 	body->Emit();
 	step->Emit();
 	codegen->GenGoto(tplabel1);
@@ -210,9 +208,8 @@ void IfStmt::Emit(){
 	char * tplabel1;
 	char * tplabel2;
 
-	test->Emit();
 	tplabel1=codegen->NewLabel();
-	codegen->GenIfZ(test->GetAddr(),tplabel1);
+	test->EmitBranch(tplabel1, false);
 	body->Emit();
 
 	if(elseBody){
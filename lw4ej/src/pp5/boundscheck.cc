@@ -0,0 +1,432 @@
+/* File: boundscheck.cc
+ * --------------------
+ * Array bounds-check elimination by range analysis on SSA form.
+ *
+ * Every array subscript is checked by a BoundsCheck of the index against
+ * the array's length (loaded from the word before the array), and every
+ * new array's size by a SizeCheck. A check can go where it is known to
+ * pass. What is known comes from the checks and tests on the way there:
+ * the code after a check only runs if it passed, a block whose only
+ * predecessor ends with a test is only entered if the test went that
+ * way, and what holds at the end of a block holds in the blocks it
+ * dominates. A test of a Less, Eq, And or Or says something of their
+ * operands too, so a check passed tells that the index is in bounds to
+ * the accesses it dominates (with the same index and length, as value
+ * numbering makes them), and the test of
+ * "for (i = 0; i < a.length(); i = i + 1)" tells that i < a.length()
+ * to the loop body. Only facts of renamed variables are kept, as a
+ * global may be assigned again anywhere after a fact about it is found.
+ *
+ * Some variables are known not to be negative wherever they are used:
+ * the comparisons, the non-negative constants, the array lengths, and
+ * the phis and sums of such variables. As a loop counter's phi and its
+ * increment depend on each other, this is found by assuming it of all
+ * of them and dropping those that don't follow until none do. The
+ * length of an array allocated in the function is the size it was
+ * allocated with, a constant more often than not.
+ *
+ * Any test found to always go the same way is replaced by a Goto or
+ * deleted, and the blocks no longer reached are deleted. The loads of
+ * lengths left unused are dead code.
+ */
+
+#include "optimize.h"
+#include <climits>
+#include <cstring>
+#include <set>
+
+
+class BoundsCheckElimination
+{
+  public:
+    BoundsCheckElimination(FlowGraph *graph);
+    bool Run();
+
+  private:
+    struct Fact {                       // a rel b, or a rel imm if b is NULL
+      Location *a;
+      IfCmp::Relation rel;
+      Location *b;
+      int imm;
+    };
+    typedef std::vector<Fact> Facts;
+    struct Range { long long lo, hi; };
+
+    FlowGraph *graph;
+    std::map<Location*, Instruction*> definition;
+    std::map<Location*, BasicBlock*> blockOf;
+    std::map<BasicBlock*, Facts> known;         // holding at end of block
+    std::set<Location*> nonNegative;
+
+    Instruction *Def(Location *var);
+    Location *LengthOf(Location *array);
+    Location *Canonical(Location *var);
+    void Assume(Location *var, bool truth, Facts &facts);
+    void AddEdgeFacts(BasicBlock *b, Facts &facts);
+    void FindNonNegative();
+    Range RangeOf(Location *var, const Facts &facts);
+    int Compare(Location *a, IfCmp::Relation rel, Location *b, int imm, const Facts &facts);
+    int Truth(Location *var, const Facts &facts);
+    void AddFact(Location *a, IfCmp::Relation rel, Location *b, int imm, Facts &facts);
+    bool Passes(Instruction *check, Facts &facts);
+    int Resolve(Instruction *test, const Facts &facts);
+};
+
+BoundsCheckElimination::BoundsCheckElimination(FlowGraph *g) : graph(g) {}
+
+Instruction *BoundsCheckElimination::Def(Location *var)
+{
+  std::map<Location*, Instruction*>::iterator it = definition.find(var);
+  return it == definition.end() ? NULL : it->second;
+}
+
+// The size an array was allocated with, if it was allocated in the
+// function: the array is at the allocation + 4, after the size stored
+// there.
+Location *BoundsCheckElimination::LengthOf(Location *array)
+{
+  BinaryOp *add = dynamic_cast<BinaryOp*>(Def(array));
+  if (!add || add->GetOpCode() != BinaryOp::AddU || !add->HasImmediate()
+      || add->GetImmediate() != 4)
+    return NULL;
+  Location *raw = add->GetSrc(0);
+  LCall *alloc = dynamic_cast<LCall*>(Def(raw));
+  if (!alloc || !alloc->IsBuiltIn() || strcmp(alloc->GetLabel(), "_Alloc"))
+    return NULL;
+  std::vector<Instruction*> &code = blockOf[raw]->code;
+  for (int i = 0; i < code.size(); i++) {
+    Store *store = dynamic_cast<Store*>(code[i]);
+    if (store && store->GetSrc(0) == raw && store->GetOffset() == 0)
+      return store->GetSrc(1);
+  }
+  return NULL;
+}
+
+// An array's length as its allocated size where that is known, so the
+// loads of it and the size compare equal.
+Location *BoundsCheckElimination::Canonical(Location *var)
+{
+  Load *load = dynamic_cast<Load*>(Def(var));
+  if (load && load->GetOffset() == -4) {
+    Location *size = LengthOf(load->GetSrc(0));
+    if (size) return size;
+  }
+  return var;
+}
+
+// Adds to facts what var being true (not zero) or false says.
+void BoundsCheckElimination::Assume(Location *var, bool truth, Facts &facts)
+{
+  AddFact(var, truth ? IfCmp::Ne : IfCmp::Eq, NULL, 0, facts);
+  BinaryOp *op = dynamic_cast<BinaryOp*>(Def(var));
+  if (!op) return;
+  Location *x = op->GetSrc(0), *y = op->HasImmediate() ? NULL : op->GetSrc(1);
+  int imm = op->HasImmediate() ? op->GetImmediate() : 0;
+  switch (op->GetOpCode()) {
+    case BinaryOp::Less:
+      AddFact(x, truth ? IfCmp::Less : IfCmp::GreaterEq, y, imm, facts);
+      break;
+    case BinaryOp::Eq:
+      AddFact(x, truth ? IfCmp::Eq : IfCmp::Ne, y, imm, facts);
+      if (!y && imm == 0)
+        Assume(x, !truth, facts);                 // x == 0 is !x
+      break;
+    case BinaryOp::Or:
+      if (!truth && y) {
+        Assume(x, false, facts);
+        Assume(y, false, facts);
+      }
+      break;
+    case BinaryOp::And:
+      if (truth && y) {
+        Assume(x, true, facts);
+        Assume(y, true, facts);
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+// What the test ending b's only predecessor says on the way to b.
+void BoundsCheckElimination::AddEdgeFacts(BasicBlock *b, Facts &facts)
+{
+  if (b->preds.size() != 1 || b->preds[0]->succs.size() != 2) return;
+  Instruction *test = b->preds[0]->Last();
+  const char *target = FlowGraph::BranchTarget(test);
+  bool taken = b->GetLabel() && target && !strcmp(b->GetLabel(), target);
+  if (dynamic_cast<IfZ*>(test))
+    Assume(test->GetSrc(0), !taken, facts);
+  else if (IfCmp *cmp = dynamic_cast<IfCmp*>(test)) {
+    Location *y = cmp->HasImmediate() ? NULL : cmp->GetSrc(1);
+    int imm = cmp->HasImmediate() ? cmp->GetImmediate() : 0;
+    IfCmp::Relation rel = cmp->GetRelation();
+    AddFact(cmp->GetSrc(0), taken ? rel : IfCmp::Negate(rel), y, imm, facts);
+  }
+}
+
+/* Method: FindNonNegative
+ * -----------------------
+ * Starts from all the variables that might not be negative and drops
+ * those whose definition doesn't make them so given the others, until
+ * none is dropped. A sum of non-negative values is one, as add and
+ * addi trap on overflow rather than wrap around.
+ */
+void BoundsCheckElimination::FindNonNegative()
+{
+  std::vector<Instruction*> candidates;
+  std::map<Location*, Instruction*>::iterator it;
+  for (it = definition.begin(); it != definition.end(); ++it) {
+    Instruction *def = it->second;
+    BinaryOp *op = dynamic_cast<BinaryOp*>(def);
+    LoadConstant *lc = dynamic_cast<LoadConstant*>(def);
+    Load *load = dynamic_cast<Load*>(def);
+    if (op && op->GetOpCode() != BinaryOp::Add) {
+      BinaryOp::OpCode code = op->GetOpCode();
+      if (code == BinaryOp::Less || code == BinaryOp::Eq || code == BinaryOp::And
+          || code == BinaryOp::Or)
+        nonNegative.insert(it->first);
+    } else if ((lc && lc->GetValue() >= 0) || (load && load->GetOffset() == -4))
+      nonNegative.insert(it->first);
+    else if (op || dynamic_cast<Phi*>(def) || dynamic_cast<Assign*>(def)) {
+      nonNegative.insert(it->first);
+      candidates.push_back(def);
+    }
+  }
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int i = 0; i < candidates.size(); i++) {
+      Instruction *def = candidates[i];
+      if (!nonNegative.count(def->GetDst())) continue;
+      BinaryOp *add = dynamic_cast<BinaryOp*>(def);
+      bool holds = !add || !add->HasImmediate() || add->GetImmediate() >= 0;
+      for (int s = 0; s < def->NumSrcs() && holds; s++)
+        holds = nonNegative.count(def->GetSrc(s)) > 0;
+      if (!holds) {
+        nonNegative.erase(def->GetDst());
+        changed = true;
+      }
+    }
+  }
+}
+
+BoundsCheckElimination::Range BoundsCheckElimination::RangeOf(Location *var, const Facts &facts)
+{
+  Range r = { INT_MIN, INT_MAX };
+  var = Canonical(var);
+  if (LoadConstant *lc = dynamic_cast<LoadConstant*>(Def(var))) {
+    r.lo = r.hi = lc->GetValue();
+    return r;
+  }
+  if (nonNegative.count(var)) r.lo = 0;
+  BinaryOp *op = dynamic_cast<BinaryOp*>(Def(var));
+  if (op && op->HasImmediate()
+      && (op->GetOpCode() == BinaryOp::Add || op->GetOpCode() == BinaryOp::Sub)) {
+    long long c = op->GetOpCode() == BinaryOp::Add ? op->GetImmediate() : -op->GetImmediate();
+    Range x = RangeOf(op->GetSrc(0), facts);
+    if (x.lo + c >= INT_MIN && x.hi + c <= INT_MAX) {   // else it may trap
+      r.lo = std::max(r.lo, x.lo + c);
+      r.hi = std::min(r.hi, x.hi + c);
+    }
+  }
+  for (int i = 0; i < facts.size(); i++) {
+    Fact f = facts[i];
+    if (f.b && Canonical(f.b) == var) {
+      std::swap(f.a, f.b);
+      f.rel = IfCmp::Reverse(f.rel);
+    }
+    if (Canonical(f.a) != var) continue;
+    long long c = f.imm;
+    if (f.b) {
+      LoadConstant *lc = dynamic_cast<LoadConstant*>(Def(Canonical(f.b)));
+      if (!lc) {                      // var < anything is at most INT_MAX - 1
+        if (f.rel == IfCmp::Less) r.hi = std::min(r.hi, (long long)INT_MAX - 1);
+        if (f.rel == IfCmp::Greater) r.lo = std::max(r.lo, (long long)INT_MIN + 1);
+        continue;
+      }
+      c = lc->GetValue();
+    }
+    switch (f.rel) {
+      case IfCmp::Eq:        r.lo = std::max(r.lo, c); r.hi = std::min(r.hi, c); break;
+      case IfCmp::Less:      r.hi = std::min(r.hi, c - 1); break;
+      case IfCmp::LessEq:    r.hi = std::min(r.hi, c); break;
+      case IfCmp::Greater:   r.lo = std::max(r.lo, c + 1); break;
+      case IfCmp::GreaterEq: r.lo = std::max(r.lo, c); break;
+      default: break;
+    }
+  }
+  return r;
+}
+
+// Which of a < b, a == b and a > b the relation allows, as bits 4, 2, 1.
+static int Outcomes(IfCmp::Relation rel)
+{
+  static const int outcomes[IfCmp::NumRelations] = { 2, 5, 4, 6, 1, 3 };
+  return outcomes[rel];
+}
+
+/* Method: Compare
+ * ---------------
+ * Returns 1 if a rel b (or a rel imm if b is NULL) is sure to hold, 0
+ * if it is sure not to, -1 if it can't tell. The outcomes left possible
+ * are those allowed by the ranges of a and b and by the facts relating
+ * them directly.
+ */
+int BoundsCheckElimination::Compare(Location *a, IfCmp::Relation rel, Location *b, int imm,
+                                    const Facts &facts)
+{
+  Range ra = RangeOf(a, facts), rb = { imm, imm };
+  if (b) rb = RangeOf(b, facts);
+  int possible = 7;
+  if (ra.lo >= rb.hi) possible &= ~4;
+  if (ra.hi <= rb.lo) possible &= ~1;
+  if (ra.hi < rb.lo || ra.lo > rb.hi) possible &= ~2;
+
+  a = Canonical(a);
+  if (b) b = Canonical(b);
+  if (a == b) possible &= 2;
+  for (int i = 0; i < facts.size(); i++) {
+    const Fact &f = facts[i];
+    Location *fa = Canonical(f.a), *fb = f.b ? Canonical(f.b) : NULL;
+    if (fa == a && fb == b && (b || f.imm == imm))
+      possible &= Outcomes(f.rel);
+    else if (b && fa == b && fb == a)
+      possible &= Outcomes(IfCmp::Reverse(f.rel));
+  }
+
+  if (possible == 0) return -1;       // can't be reached
+  if ((possible & ~Outcomes(rel)) == 0) return 1;
+  if ((possible & Outcomes(rel)) == 0) return 0;
+  return -1;
+}
+
+// Returns 1 if var is sure to be true (not zero), 0 if sure to be
+// false, -1 if it can't tell.
+int BoundsCheckElimination::Truth(Location *var, const Facts &facts)
+{
+  int t = Compare(var, IfCmp::Ne, NULL, 0, facts);
+  BinaryOp *op = dynamic_cast<BinaryOp*>(Def(var));
+  if (t >= 0 || !op) return t;
+  Location *x = op->GetSrc(0), *y = op->HasImmediate() ? NULL : op->GetSrc(1);
+  int imm = op->HasImmediate() ? op->GetImmediate() : 0;
+  int tx, ty;
+  switch (op->GetOpCode()) {
+    case BinaryOp::Less:
+      return Compare(x, IfCmp::Less, y, imm, facts);
+    case BinaryOp::Eq:
+      t = Compare(x, IfCmp::Eq, y, imm, facts);
+      if (t >= 0 || y || imm != 0) return t;
+      tx = Truth(x, facts);                       // x == 0 is !x
+      return tx < 0 ? -1 : !tx;
+    case BinaryOp::Or:
+      tx = Truth(x, facts);
+      ty = y ? Truth(y, facts) : imm != 0;
+      if (tx == 1 || ty == 1) return 1;
+      return (tx == 0 && ty == 0) ? 0 : -1;
+    case BinaryOp::And:
+      tx = Truth(x, facts);
+      ty = y ? Truth(y, facts) : imm != 0;
+      if (tx == 0 || ty == 0) return 0;
+      return (tx == 1 && ty == 1) ? 1 : -1;
+    default:
+      return -1;
+  }
+}
+
+// Adds a rel b (or a rel imm) to facts, unless it is of a global: not
+// in SSA form, a global may be assigned again in the blocks the fact is
+// passed down to.
+void BoundsCheckElimination::AddFact(Location *a, IfCmp::Relation rel, Location *b, int imm,
+                                     Facts &facts)
+{
+  if (!SSA::IsRenamed(a) || (b && !SSA::IsRenamed(b))) return;
+  Fact f = { a, rel, b, imm };
+  facts.push_back(f);
+}
+
+// Whether the BoundsCheck or SizeCheck is sure to pass; if not, adds
+// what passing it says to facts.
+bool BoundsCheckElimination::Passes(Instruction *check, Facts &facts)
+{
+  Location *index = check->GetSrc(0);
+  if (dynamic_cast<BoundsCheck*>(check)) {
+    Location *length = check->GetSrc(1);
+    if (Compare(index, IfCmp::GreaterEq, NULL, 0, facts) == 1
+        && Compare(index, IfCmp::Less, length, 0, facts) == 1)
+      return true;
+    AddFact(index, IfCmp::GreaterEq, NULL, 0, facts);
+    AddFact(index, IfCmp::Less, length, 0, facts);
+    return false;
+  }
+  if (Compare(index, IfCmp::GreaterEq, NULL, 0, facts) == 1)
+    return true;
+  AddFact(index, IfCmp::GreaterEq, NULL, 0, facts);
+  return false;
+}
+
+// Returns 1 if the IfZ or IfCmp is sure to jump, 0 if sure not to, -1
+// if it can't tell or test is neither.
+int BoundsCheckElimination::Resolve(Instruction *test, const Facts &facts)
+{
+  if (dynamic_cast<IfZ*>(test)) {
+    int truth = Truth(test->GetSrc(0), facts);
+    return truth < 0 ? -1 : !truth;                 // taken if false
+  }
+  if (IfCmp *cmp = dynamic_cast<IfCmp*>(test)) {
+    Location *y = cmp->HasImmediate() ? NULL : cmp->GetSrc(1);
+    int imm = cmp->HasImmediate() ? cmp->GetImmediate() : 0;
+    return Compare(cmp->GetSrc(0), cmp->GetRelation(), y, imm, facts);
+  }
+  return -1;
+}
+
+bool BoundsCheckElimination::Run()
+{
+  std::vector<BasicBlock*> &rpo = graph->rpo;
+  for (int b = 0; b < rpo.size(); b++) {
+    std::vector<Instruction*> &code = rpo[b]->code;
+    for (int i = 0; i < code.size(); i++)
+      if (SSA::IsRenamed(code[i]->GetDst())) {
+        definition[code[i]->GetDst()] = code[i];
+        blockOf[code[i]->GetDst()] = rpo[b];
+      }
+  }
+  FindNonNegative();
+
+  // the tests are resolved after all blocks are done, as the facts
+  // from the edges out of a block are taken from its code as it was
+  std::vector<std::pair<BasicBlock*, int> > resolved;
+  for (int b = 0; b < rpo.size(); b++) {        // idom comes first
+    Facts &facts = known[rpo[b]];
+    if (rpo[b]->idom) facts = known[rpo[b]->idom];
+    AddEdgeFacts(rpo[b], facts);
+    std::vector<Instruction*> &code = rpo[b]->code;
+    for (int i = 0; i < code.size(); i++)
+      if ((dynamic_cast<BoundsCheck*>(code[i]) || dynamic_cast<SizeCheck*>(code[i]))
+          && Passes(code[i], facts))
+        code.erase(code.begin() + i--);
+    int holds = Resolve(rpo[b]->Last(), facts);
+    if (holds >= 0) resolved.push_back(std::make_pair(rpo[b], holds));
+  }
+
+  if (resolved.empty()) return false;
+  for (int r = 0; r < resolved.size(); r++) {
+    std::vector<Instruction*> &code = resolved[r].first->code;
+    if (resolved[r].second)
+      code.back() = new Goto(FlowGraph::BranchTarget(code.back()));
+    else
+      code.pop_back();
+  }
+  graph->FindEdges();
+  graph->RemoveUnreachableBlocks();
+  graph->RemoveJumpsToNext();
+  return true;
+}
+
+bool EliminateBoundsChecks(FlowGraph *graph)
+{
+  BoundsCheckElimination pass(graph);
+  return pass.Run();
+}
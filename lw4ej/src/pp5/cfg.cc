@@ -0,0 +1,412 @@
+/* File: cfg.cc
+ * ------------
+ * Implementation of the FlowGraph, BasicBlock and Loop classes.
+ */
+
+#include "cfg.h"
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <string>
+
+
+BasicBlock::BasicBlock(int n)
+  : id(n), rpo(-1), idom(NULL), loop(NULL), domPre(-1), domPost(-1) {}
+
+const char *BasicBlock::GetLabel()
+{
+  Label *l = code.empty() ? NULL : dynamic_cast<Label*>(code.front());
+  return l ? l->text() : NULL;
+}
+
+int BasicBlock::LoopDepth()
+{
+  return loop ? loop->depth : 0;
+}
+
+// A block dominates another if it is its ancestor (or itself) in the
+// dominator tree, which the DFS numbering answers in constant time.
+bool BasicBlock::Dominates(BasicBlock *other)
+{
+  return rpo >= 0 && other->rpo >= 0
+    && domPre <= other->domPre && other->domPost <= domPost;
+}
+
+bool Loop::Contains(BasicBlock *b)
+{
+  return std::find(blocks.begin(), blocks.end(), b) != blocks.end();
+}
+
+
+FlowGraph::FlowGraph(const std::vector<Instruction*> &fn)
+{
+  Assert(!fn.empty() && dynamic_cast<BeginFunc*>(fn.front())
+         && dynamic_cast<EndFunc*>(fn.back()));
+  for (int i = 0; i < fn.size(); i++) {
+    if (i == 0 || dynamic_cast<Label*>(fn[i]) || EndsBlock(fn[i-1]))
+      blocks.push_back(new BasicBlock(blocks.size()));
+    blocks.back()->code.push_back(fn[i]);
+  }
+  Analyze();
+}
+
+FlowGraph::~FlowGraph()
+{
+  ClearLoops();
+  for (int i = 0; i < blocks.size(); i++)
+    delete blocks[i];
+}
+
+const char *FlowGraph::BranchTarget(Instruction *instr)
+{
+  if (Goto *g = dynamic_cast<Goto*>(instr)) return g->branch_label();
+  if (IfZ *z = dynamic_cast<IfZ*>(instr)) return z->branch_label();
+  if (IfCmp *c = dynamic_cast<IfCmp*>(instr)) return c->branch_label();
+  return NULL;
+}
+
+void FlowGraph::SetBranchTarget(Instruction *instr, const char *label)
+{
+  if (Goto *g = dynamic_cast<Goto*>(instr)) g->SetLabel(label);
+  else if (IfZ *z = dynamic_cast<IfZ*>(instr)) z->SetLabel(label);
+  else if (IfCmp *c = dynamic_cast<IfCmp*>(instr)) c->SetLabel(label);
+  else Assert(0);
+}
+
+bool FlowGraph::IsHalt(Instruction *instr)
+{
+  LCall *call = dynamic_cast<LCall*>(instr);
+  return call && call->IsBuiltIn() && !strcmp(call->GetLabel(), "_Halt");
+}
+
+bool FlowGraph::EndsBlock(Instruction *instr)
+{
+  return BranchTarget(instr) != NULL || dynamic_cast<Return*>(instr) || IsHalt(instr);
+}
+
+void FlowGraph::Analyze()
+{
+  FindEdges();
+  ComputeDominators();
+  FindLoops();
+}
+
+void FlowGraph::FindEdges()
+{
+  BuildEdges();
+  ComputeOrder();
+}
+
+void FlowGraph::Renumber()
+{
+  for (int i = 0; i < blocks.size(); i++)
+    blocks[i]->id = i;
+  Analyze();
+}
+
+// The EndFunc has to stay, so an unreachable block ending in it is
+// kept with just that instruction.
+bool FlowGraph::RemoveUnreachableBlocks()
+{
+  std::vector<BasicBlock*> reachable, dead;
+  for (int i = 0; i < blocks.size(); i++) {
+    BasicBlock *b = blocks[i];
+    if (b->rpo < 0 && dynamic_cast<EndFunc*>(b->Last()))
+      b->code.erase(b->code.begin(), b->code.end() - 1);
+    else if (b->rpo < 0) {
+      dead.push_back(b);
+      continue;
+    }
+    reachable.push_back(b);
+  }
+  if (dead.empty()) return false;
+  blocks = reachable;
+  for (int i = 0; i < blocks.size(); i++)
+    blocks[i]->id = i;
+  FindEdges();
+  for (int i = 0; i < dead.size(); i++)    // after the phis were matched
+    delete dead[i];
+  return true;
+}
+
+void FlowGraph::RemoveJumpsToNext()
+{
+  for (int i = 0; i + 1 < blocks.size(); i++) {
+    const char *target = BranchTarget(blocks[i]->Last()), *next = blocks[i+1]->GetLabel();
+    if (dynamic_cast<Goto*>(blocks[i]->Last()) && next && !strcmp(target, next))
+      blocks[i]->code.pop_back();
+  }
+}
+
+std::vector<Instruction*> FlowGraph::Linearize()
+{
+  std::vector<Instruction*> fn;
+  for (int i = 0; i < blocks.size(); i++)
+    fn.insert(fn.end(), blocks[i]->code.begin(), blocks[i]->code.end());
+  return fn;
+}
+
+std::vector<Instruction*> FlowGraph::FunctionAt(std::list<Instruction*>::iterator p)
+{
+  std::vector<Instruction*> body;
+  do {
+    body.push_back(*p);
+  } while (!dynamic_cast<EndFunc*>(*p++));
+  return body;
+}
+
+static void AddEdge(BasicBlock *from, BasicBlock *to)
+{
+  if (std::find(from->succs.begin(), from->succs.end(), to) != from->succs.end())
+    return;
+  from->succs.push_back(to);
+  to->preds.push_back(from);
+}
+
+// A phi has one argument per predecessor, in the order of preds. When
+// the edges change, each argument follows its predecessor; those of
+// lost edges are dropped, and a new edge gets the phi's own variable.
+static void MatchPhis(BasicBlock *b, const std::vector<BasicBlock*> &oldPreds)
+{
+  if (b->preds == oldPreds || b->preds.empty()) return;
+  for (int i = b->GetLabel() ? 1 : 0; i < b->code.size(); i++) {
+    Phi *phi = dynamic_cast<Phi*>(b->code[i]);
+    if (!phi) break;
+    std::vector<Location*> args;
+    for (int p = 0; p < b->preds.size(); p++) {
+      int old = std::find(oldPreds.begin(), oldPreds.end(), b->preds[p]) - oldPreds.begin();
+      args.push_back(old < oldPreds.size() ? phi->GetSrc(old) : phi->GetDst());
+    }
+    phi->SetSrcs(args);
+  }
+}
+
+/* Method: BuildEdges
+ * ------------------
+ * A block ending in a branch has an edge to the block with the target
+ * label, and unless it ends in Goto, Return, EndFunc or a call to Halt,
+ * one to the block laid out after it. Two edges to the same block are
+ * merged.
+ */
+void FlowGraph::BuildEdges()
+{
+  std::map<std::string, BasicBlock*> blockForLabel;
+  std::vector<std::vector<BasicBlock*> > oldPreds(blocks.size());
+  for (int i = 0; i < blocks.size(); i++) {
+    oldPreds[i].swap(blocks[i]->preds);
+    blocks[i]->succs.clear();
+    if (const char *label = blocks[i]->GetLabel())
+      blockForLabel[label] = blocks[i];
+  }
+  for (int i = 0; i < blocks.size(); i++) {
+    Instruction *last = blocks[i]->Last();
+    if (const char *target = BranchTarget(last)) {
+      Assert(blockForLabel.count(target));
+      AddEdge(blocks[i], blockForLabel[target]);
+    }
+    if (!dynamic_cast<Goto*>(last) && !dynamic_cast<Return*>(last)
+        && !dynamic_cast<EndFunc*>(last) && !IsHalt(last) && i + 1 < blocks.size())
+      AddEdge(blocks[i], blocks[i+1]);
+  }
+  for (int i = 0; i < blocks.size(); i++)
+    MatchPhis(blocks[i], oldPreds[i]);
+}
+
+// Numbers the blocks reachable from entry in reverse postorder with
+// an explicit stack, so deep graphs don't overflow the C++ stack.
+void FlowGraph::ComputeOrder()
+{
+  std::vector<bool> visited(blocks.size(), false);
+  std::vector<BasicBlock*> postorder;
+  std::vector<std::pair<BasicBlock*, int> > stack;
+  stack.push_back(std::make_pair(Entry(), 0));
+  visited[Entry()->id] = true;
+  while (!stack.empty()) {
+    BasicBlock *b = stack.back().first;
+    int next = stack.back().second++;
+    if (next < b->succs.size()) {
+      BasicBlock *s = b->succs[next];
+      if (!visited[s->id]) {
+        visited[s->id] = true;
+        stack.push_back(std::make_pair(s, 0));
+      }
+    } else {
+      postorder.push_back(b);
+      stack.pop_back();
+    }
+  }
+  rpo.assign(postorder.rbegin(), postorder.rend());
+  for (int i = 0; i < blocks.size(); i++)
+    blocks[i]->rpo = -1;
+  for (int i = 0; i < rpo.size(); i++)
+    rpo[i]->rpo = i;
+}
+
+static BasicBlock *Intersect(BasicBlock *a, BasicBlock *b)
+{
+  while (a != b) {
+    while (a->rpo > b->rpo) a = a->idom;
+    while (b->rpo > a->rpo) b = b->idom;
+  }
+  return a;
+}
+
+/* Method: ComputeDominators
+ * -------------------------
+ * "A Simple, Fast Dominance Algorithm" (Cooper, Harvey, Kennedy): in
+ * reverse postorder, a block's immediate dominator is the nearest
+ * common ancestor of its already processed predecessors, repeated
+ * until nothing changes (once or twice for structured code). The tree
+ * is then numbered by a DFS for the constant-time Dominates test.
+ */
+void FlowGraph::ComputeDominators()
+{
+  for (int i = 0; i < blocks.size(); i++) {
+    blocks[i]->idom = NULL;
+    blocks[i]->domChildren.clear();
+    blocks[i]->domPre = blocks[i]->domPost = -1;
+  }
+  Entry()->idom = Entry();
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int i = 1; i < rpo.size(); i++) {
+      BasicBlock *b = rpo[i], *newIdom = NULL;
+      for (int p = 0; p < b->preds.size(); p++) {
+        BasicBlock *pred = b->preds[p];
+        if (pred->idom == NULL) continue;       // unprocessed or unreachable
+        newIdom = newIdom ? Intersect(pred, newIdom) : pred;
+      }
+      if (newIdom != b->idom) {
+        b->idom = newIdom;
+        changed = true;
+      }
+    }
+  }
+  Entry()->idom = NULL;
+  for (int i = 1; i < rpo.size(); i++)
+    rpo[i]->idom->domChildren.push_back(rpo[i]);
+
+  int counter = 0;
+  std::vector<std::pair<BasicBlock*, int> > stack;
+  stack.push_back(std::make_pair(Entry(), 0));
+  Entry()->domPre = counter++;
+  while (!stack.empty()) {
+    BasicBlock *b = stack.back().first;
+    int next = stack.back().second++;
+    if (next < b->domChildren.size()) {
+      BasicBlock *child = b->domChildren[next];
+      child->domPre = counter++;
+      stack.push_back(std::make_pair(child, 0));
+    } else {
+      b->domPost = counter++;
+      stack.pop_back();
+    }
+  }
+}
+
+void FlowGraph::ClearLoops()
+{
+  for (int i = 0; i < loops.size(); i++)
+    delete loops[i];
+  loops.clear();
+  for (int i = 0; i < blocks.size(); i++)
+    blocks[i]->loop = NULL;
+}
+
+static bool LargerLoop(Loop *a, Loop *b)
+{
+  return a->blocks.size() > b->blocks.size();
+}
+
+/* Method: FindLoops
+ * -----------------
+ * An edge from a block to one of its dominators is a back edge, and
+ * the dominator a loop header. The natural loop of a header is the
+ * header plus every block that reaches one of its back edges without
+ * going through the header. Two such loops are disjoint or one is
+ * nested in the other, so sorting them by size puts each loop after
+ * all loops around it; its parent is the smallest of them containing
+ * its header.
+ */
+void FlowGraph::FindLoops()
+{
+  ClearLoops();
+  for (int i = 0; i < rpo.size(); i++) {
+    BasicBlock *header = rpo[i];
+    Loop *loop = NULL;
+    for (int p = 0; p < header->preds.size(); p++)
+      if (header->Dominates(header->preds[p])) {
+        if (!loop) {
+          loop = new Loop;
+          loop->header = header;
+          loop->parent = NULL;
+          loop->depth = 1;
+        }
+        loop->latches.push_back(header->preds[p]);
+      }
+    if (!loop) continue;
+
+    std::vector<bool> inLoop(blocks.size(), false);
+    inLoop[header->id] = true;
+    loop->blocks.push_back(header);
+    std::vector<BasicBlock*> work(loop->latches);
+    while (!work.empty()) {
+      BasicBlock *b = work.back();
+      work.pop_back();
+      if (inLoop[b->id]) continue;
+      inLoop[b->id] = true;
+      loop->blocks.push_back(b);
+      for (int p = 0; p < b->preds.size(); p++)
+        if (b->preds[p]->rpo >= 0 && !inLoop[b->preds[p]->id])
+          work.push_back(b->preds[p]);
+    }
+    loops.push_back(loop);
+  }
+
+  std::stable_sort(loops.begin(), loops.end(), LargerLoop);
+  for (int i = 0; i < loops.size(); i++) {
+    Loop *loop = loops[i];
+    for (int j = i - 1; j >= 0 && !loop->parent; j--)
+      if (loops[j]->Contains(loop->header))
+        loop->parent = loops[j];
+    loop->depth = loop->parent ? loop->parent->depth + 1 : 1;
+    for (int b = 0; b < loop->blocks.size(); b++)
+      loop->blocks[b]->loop = loop;
+  }
+}
+
+static void PrintBlockList(const char *title, std::vector<BasicBlock*> &list)
+{
+  printf(" %s", title);
+  for (int i = 0; i < list.size(); i++)
+    printf(" B%d", list[i]->id);
+}
+
+void FlowGraph::Print()
+{
+  for (int i = 0; i < blocks.size(); i++) {
+    BasicBlock *b = blocks[i];
+    printf("  B%d:", b->id);
+    PrintBlockList("preds", b->preds);
+    printf(";");
+    PrintBlockList("succs", b->succs);
+    printf(";");
+    if (b->rpo < 0)
+      printf(" unreachable\n");
+    else if (b->idom)
+      printf(" idom B%d; loop depth %d\n", b->idom->id, b->LoopDepth());
+    else
+      printf(" entry\n");
+    for (int j = 0; j < b->code.size(); j++)
+      b->code[j]->Print();
+  }
+  for (int i = 0; i < loops.size(); i++) {
+    Loop *loop = loops[i];
+    printf("  loop at B%d: depth %d;", loop->header->id, loop->depth);
+    if (loop->parent)
+      printf(" inside loop at B%d;", loop->parent->header->id);
+    PrintBlockList("blocks", loop->blocks);
+    printf("\n");
+  }
+}
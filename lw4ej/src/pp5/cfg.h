@@ -0,0 +1,132 @@
+/* File: cfg.h
+ * -----------
+ * The FlowGraph class is the control-flow graph of one function: the
+ * Tac from BeginFunc to EndFunc split into basic blocks, with the
+ * predecessor/successor edges between them. It is the common ground
+ * for the passes that work on a whole function.
+ *
+ * A block starts at a Label (which stays its first instruction) or
+ * right after a branch or return, and ends with at most one Goto, IfZ,
+ * IfCmp, Return or call to Halt. A block not ending in Goto, Return or
+ * Halt (which never returns) falls through to the block after it in
+ * the blocks vector, so the order of that vector is the layout of the
+ * code: Linearize concatenates the blocks in that order to give back a
+ * flat list of instructions.
+ *
+ * Analyze computes, from the blocks and their instructions, the edges,
+ * a reverse postorder, the dominator tree (with the iterative algorithm
+ * of Cooper, Harvey and Kennedy) and the natural loops and their
+ * nesting. A pass that changes the branches or the blocks brings the
+ * edges and the order up to date with FindEdges, and leaves the rest
+ * for Analyze to redo before a pass that uses it (see passmanager.h),
+ * unless it goes on to use it itself; the arguments of the phis in SSA
+ * form stay matched with the predecessors they come from.
+ */
+
+#ifndef _H_cfg
+#define _H_cfg
+
+#include <list>
+#include <vector>
+#include "tac.h"
+
+class Loop;
+
+class BasicBlock
+{
+  public:
+    int id;                             // index in FlowGraph::blocks
+    std::vector<Instruction*> code;
+    std::vector<BasicBlock*> preds, succs;
+
+    // filled in by FlowGraph::Analyze
+    int rpo;                            // reverse postorder number,
+                                        // -1 if unreachable from entry
+    BasicBlock *idom;                   // NULL for entry and unreachable
+    std::vector<BasicBlock*> domChildren;
+    Loop *loop;                         // innermost loop, NULL if none
+
+    BasicBlock(int id);
+    const char *GetLabel();             // NULL if block has no Label
+    Instruction *Last() { return code.empty() ? NULL : code.back(); }
+    int LoopDepth();
+    bool Dominates(BasicBlock *other);
+
+  private:
+    int domPre, domPost;                // dominator tree DFS numbering
+    friend class FlowGraph;
+};
+
+class Loop
+{
+  public:
+    BasicBlock *header;
+    Loop *parent;                       // enclosing loop, NULL if outermost
+    int depth;                          // 1 for an outermost loop
+    std::vector<BasicBlock*> blocks;    // header first, inner loops' too
+    std::vector<BasicBlock*> latches;   // sources of the back edges
+
+    bool Contains(BasicBlock *b);
+};
+
+class FlowGraph
+{
+  public:
+    std::vector<BasicBlock*> blocks;    // in layout order, entry first
+    std::vector<BasicBlock*> rpo;       // reachable blocks, reverse postorder
+    std::vector<Loop*> loops;           // outer loops before inner ones
+
+         // Splits the code, which must start with BeginFunc and end
+         // with EndFunc, into blocks and analyzes them.
+    FlowGraph(const std::vector<Instruction*> &fn);
+    ~FlowGraph();
+
+    BasicBlock *Entry() { return blocks.front(); }
+
+         // Recomputes edges, dominators and loops after a change.
+    void Analyze();
+
+         // Recomputes only the edges and the reverse postorder, leaving
+         // the dominators and loops out of date until Analyze.
+    void FindEdges();
+
+         // Renumbers the blocks after some were added to or removed
+         // from the blocks vector, then analyzes again.
+    void Renumber();
+
+         // Deletes the blocks the reverse postorder doesn't reach from
+         // entry, all but the EndFunc of the last one, and finds the
+         // edges of the others again. Returns true if it deleted any,
+         // which leaves the dominators and loops out of date.
+    bool RemoveUnreachableBlocks();
+
+         // Deletes the Gotos to the block right after, as left by
+         // deleting the blocks they used to jump over.
+    void RemoveJumpsToNext();
+
+         // The instructions of all blocks, in layout order.
+    std::vector<Instruction*> Linearize();
+
+         // The instructions of the function whose BeginFunc is at p in
+         // a list of the whole program's, up to its EndFunc.
+    static std::vector<Instruction*> FunctionAt(std::list<Instruction*>::iterator p);
+
+         // Prints the blocks, their edges and the loops (-d cfg).
+    void Print();
+
+         // The label a Goto, IfZ or IfCmp jumps to, NULL for any other
+         // instruction. EndsBlock is true for those, Return and Halt.
+    static const char *BranchTarget(Instruction *instr);
+    static void SetBranchTarget(Instruction *instr, const char *label);
+    static bool IsHalt(Instruction *instr);
+    static bool EndsBlock(Instruction *instr);
+
+  private:
+    void BuildEdges();
+    void ComputeOrder();
+    void ComputeDominators();
+    void FindLoops();
+    void ClearLoops();
+};
+
+#endif
@@ -7,8 +7,12 @@
 
 #include "codegen.h"
 #include <string.h>
+#include <algorithm>
+#include <climits>
 #include "tac.h"
 #include "mips.h"
+#include "cfg.h"
+#include "passmanager.h"
 
 Location* CodeGenerator::ThisPtr= new Location(fpRelative, 4, "this");
   
@@ -62,6 +66,7 @@ Location *CodeGenerator::GenLoadConstant(int value)
 {
   Location *result = GenTempVar();
   code.push_back(new LoadConstant(result, value));
+  constants[result] = value;
   return result;
 }
 
@@ -82,6 +87,7 @@ Location *CodeGenerator::GenLoadLabel(const char *label)
 
 void CodeGenerator::GenAssign(Location *dst, Location *src)
 {
+  constants.erase(dst);
   code.push_back(new Assign(dst, src));
 }
 
@@ -93,6 +99,13 @@ Location *CodeGenerator::GenLoad(Location *ref, int offset)
   return result;
 }
 
+void CodeGenerator::GenNullCheck(Location *obj)
+{
+  Load *load = new Load(GenTempVar(), obj);
+  load->SetChecksNull();
+  code.push_back(load);
+}
+
 void CodeGenerator::GenStore(Location *dst,Location *src, int offset)
 {
   code.push_back(new Store(dst, src, offset));
@@ -101,23 +114,210 @@ void CodeGenerator::GenStore(Location *dst,Location *src, int offset)
 
 Location *CodeGenerator::GenBinaryOp(const char *opName, Location *op1,
 						     Location *op2)
+{
+  BinaryOp::OpCode op = BinaryOp::OpCodeForName(opName);
+  Location *result;
+  if (GetOptimizationLevel() > 0) {
+    int c1, c2, folded;
+    bool isConst1 = IsConstant(op1, &c1), isConst2 = IsConstant(op2, &c2);
+    if (isConst1 && isConst2 && FoldConstants(op, c1, c2, &folded))
+      return GenLoadConstant(folded);
+    bool commutes = (op == BinaryOp::Add || op == BinaryOp::Mul
+                     || op == BinaryOp::Eq || op == BinaryOp::And
+                     || op == BinaryOp::Or || op == BinaryOp::AddU);
+    if (isConst1 && !isConst2 && commutes) {
+      std::swap(op1, op2);
+      std::swap(c1, c2);
+      isConst2 = true;
+    }
+    if (isConst2 && (result = GenStrengthReduced(op, op1, c2)))
+      return result;
+    if (isConst2 && Mips::HasImmediateForm(op, c2))
+      return GenOp(op, op1, c2);
+  }
+  return GenOp(op, op1, op2);
+}
+
+Location *CodeGenerator::GenOp(BinaryOp::OpCode op, Location *op1, Location *op2)
 {
   Location *result = GenTempVar();
-  code.push_back(new BinaryOp(BinaryOp::OpCodeForName(opName), result, op1, op2));
+  code.push_back(new BinaryOp(op, result, op1, op2));
   return result;
 }
 
+Location *CodeGenerator::GenOp(BinaryOp::OpCode op, Location *op1, int imm)
+{
+  Location *result = GenTempVar();
+  code.push_back(new BinaryOp(op, result, op1, imm));
+  return result;
+}
+
+// Returns k if c is 2^k (for k >= 0), otherwise -1
+static int Log2(int c)
+{
+  if (c <= 0 || (c & (c - 1)) != 0) return -1;
+  int k = 0;
+  while ((1 << k) != c) k++;
+  return k;
+}
+
+/* Method: GenStrengthReduced
+ * --------------------------
+ * Generates x * c, x / c or x % c for a positive constant c without
+ * using mul/div/rem when possible, returns NULL when not. Multiplying
+ * by 2^k is a left shift. Division and modulo are done by GenDivide,
+ * and x % c is then x - (x / c) * c. Negative constants are left
+ * alone, negating the result could trap where mul and div don't.
+ */
+Location *CodeGenerator::GenStrengthReduced(BinaryOp::OpCode op, Location *x, int c)
+{
+  if (c <= 0 || (op != BinaryOp::Mul && op != BinaryOp::Div && op != BinaryOp::Mod))
+    return NULL;
+  int k = Log2(c);
+  if (op == BinaryOp::Mul) {
+    if (k < 0) return NULL;
+    return k == 0 ? GenOp(BinaryOp::Add, x, 0) : GenOp(BinaryOp::Shl, x, k);
+  }
+  if (c == 1)
+    return op == BinaryOp::Div ? GenOp(BinaryOp::Add, x, 0) : GenLoadConstant(0);
+  Location *quotient = GenDivide(x, c);
+  if (op == BinaryOp::Div)
+    return quotient;
+  Location *product = (k > 0) ? GenOp(BinaryOp::Shl, quotient, k)
+                              : GenOp(BinaryOp::Mul, quotient, GenLoadConstant(c));
+  return GenOp(BinaryOp::Sub, x, product);
+}
+
+/* Method: GenDivide
+ * -----------------
+ * Signed division by a constant c >= 2, rounding towards zero like
+ * div does. For c = 2^k, negative x is biased by c - 1 before the
+ * arithmetic shift (the bias is the sign bits shifted down). Otherwise
+ * x is multiplied by a magic number M ~ 2^(32+s)/c keeping the high
+ * word, then 1 is added for negative x (Hacker's Delight, 10-1).
+ */
+Location *CodeGenerator::GenDivide(Location *x, int c)
+{
+  int k = Log2(c);
+  if (k > 0) {
+    Location *sign = (k == 1) ? x : GenOp(BinaryOp::Shr, x, 31);
+    Location *bias = GenOp(BinaryOp::ShrU, sign, 32 - k);
+    return GenOp(BinaryOp::Shr, GenOp(BinaryOp::Add, x, bias), k);
+  }
+
+  const unsigned two31 = 0x80000000u, d = c;
+  unsigned anc = two31 - 1 - two31 % d;     // |nc|, largest multiple of d - 1
+  unsigned q1 = two31 / anc, r1 = two31 - q1 * anc;
+  unsigned q2 = two31 / d, r2 = two31 - q2 * d, delta;
+  int p = 31;
+  do {
+    p++;
+    q1 *= 2; r1 *= 2;
+    if (r1 >= anc) { q1++; r1 -= anc; }
+    q2 *= 2; r2 *= 2;
+    if (r2 >= d) { q2++; r2 -= d; }
+    delta = d - r2;
+  } while (q1 < delta || (q1 == delta && r1 == 0));
+  int magic = (int)(q2 + 1), shift = p - 32;
+
+  Location *q = GenOp(BinaryOp::MulHi, x, GenLoadConstant(magic));
+  if (magic < 0)
+    q = GenOp(BinaryOp::Add, q, x);
+  if (shift > 0)
+    q = GenOp(BinaryOp::Shr, q, shift);
+  return GenOp(BinaryOp::Add, q, GenOp(BinaryOp::ShrU, x, 31));
+}
+
+bool CodeGenerator::IsConstant(Location *var, int *value)
+{
+  std::map<Location*, int>::iterator it = constants.find(var);
+  if (it == constants.end()) return false;
+  *value = it->second;
+  return true;
+}
+
+/* Method: FoldConstants
+ * ---------------------
+ * Computes a op b at compile time the way the MIPS code would at run
+ * time. Returns false for the cases that would trap (signed overflow
+ * of add/sub) or whose result isn't defined (division by zero), which
+ * are left for run time.
+ */
+bool CodeGenerator::FoldConstants(BinaryOp::OpCode code, int a, int b, int *result)
+{
+  long long wide;
+  switch (code) {
+    case BinaryOp::Add: wide = (long long)a + b; break;
+    case BinaryOp::Sub: wide = (long long)a - b; break;
+    case BinaryOp::Mul: *result = (int)((unsigned)a * (unsigned)b); return true;
+    case BinaryOp::Div:
+    case BinaryOp::Mod:
+      if (b == 0 || (a == INT_MIN && b == -1)) return false;
+      *result = (code == BinaryOp::Div) ? a / b : a % b;
+      return true;
+    case BinaryOp::Eq:   *result = (a == b); return true;
+    case BinaryOp::Less: *result = (a < b); return true;
+    case BinaryOp::And:  *result = (a & b); return true;
+    case BinaryOp::Or:   *result = (a | b); return true;
+    case BinaryOp::Shl:  *result = (int)((unsigned)a << (b & 31)); return true;
+    case BinaryOp::Shr:  *result = a >> (b & 31); return true;
+    case BinaryOp::ShrU: *result = (int)((unsigned)a >> (b & 31)); return true;
+    case BinaryOp::MulHi: *result = (int)(((long long)a * b) >> 32); return true;
+    case BinaryOp::AddU: *result = (int)((unsigned)a + (unsigned)b); return true;
+    default: return false;
+  }
+  if (wide < INT_MIN || wide > INT_MAX) return false;
+  *result = (int)wide;
+  return true;
+}
+
 
 void CodeGenerator::GenLabel(const char *label)
 {
   code.push_back(new Label(label));
 }
 
+void CodeGenerator::GenBoundsCheck(Location *index, Location *length)
+{
+  code.push_back(new BoundsCheck(index, length));
+}
+
+void CodeGenerator::GenSizeCheck(Location *size)
+{
+  int c;
+  if (GetOptimizationLevel() > 0 && IsConstant(size, &c) && c >= 0)
+    return;
+  code.push_back(new SizeCheck(size));
+}
+
 void CodeGenerator::GenIfZ(Location *test, const char *label)
 {
   code.push_back(new IfZ(test, label));
 }
 
+void CodeGenerator::GenIfCmp(IfCmp::Relation rel, Location *op1,
+                             Location *op2, const char *label)
+{
+  int c1, c2;
+  bool isConst1 = IsConstant(op1, &c1), isConst2 = IsConstant(op2, &c2);
+  if (GetOptimizationLevel() == 0)
+    isConst1 = isConst2 = false;
+  if (isConst1 && isConst2) {
+    if (IfCmp::Holds(rel, c1, c2)) GenGoto(label);
+    return;
+  }
+  if (isConst1) {
+    std::swap(op1, op2);
+    std::swap(c1, c2);
+    rel = IfCmp::Reverse(rel);
+    isConst2 = true;
+  }
+  if (isConst2 && c2 >= -32768 && c2 <= 32767)
+    code.push_back(new IfCmp(rel, op1, c2, label));
+  else
+    code.push_back(new IfCmp(rel, op1, op2, label));
+}
+
 void CodeGenerator::GenGoto(const char *label)
 {
   code.push_back(new Goto(label));
@@ -195,7 +395,7 @@ Location *CodeGenerator::GenBuiltInCall(BuiltIn bn,Location *arg1, Location *arg
 	|| (b->numArgs == 2 && arg1 && arg2));
   if (arg2) code.push_back(new PushParam(arg2));
   if (arg1) code.push_back(new PushParam(arg1));
-  code.push_back(new LCall(b->label, result));
+  code.push_back(new LCall(b->label, result, true));
   GenPopParams(VarSize*b->numArgs);
   return result;
 }
@@ -207,9 +407,45 @@ void CodeGenerator::GenVTable(const char *className, List<const char *> *methodL
 }
 
 
+
+/* Method: RemoveUnusedConstants
+ * -------------------------------
+ * Once constants have been folded or turned into immediates, the temps
+ * they were loaded into are often never read. Deletes the LoadConstant
+ * of each such temp.
+ */
+void CodeGenerator::RemoveUnusedConstants()
+{
+  std::map<Location*, int> reads;
+  std::list<Instruction*>::iterator p;
+  for (p = code.begin(); p != code.end(); ++p)
+    for (int i = 0; i < (*p)->NumSrcs(); i++)
+      reads[(*p)->GetSrc(i)]++;
+  for (p = code.begin(); p != code.end(); ) {
+    Location *dst = (*p)->GetDst();
+    if (dynamic_cast<LoadConstant*>(*p) && constants.count(dst) && !reads[dst])
+      p = code.erase(p);
+    else
+      ++p;
+  }
+}
+
 void CodeGenerator::DoFinalCodeGen()
 {
-  if (IsDebugOn("tac")) { // if debug don't translate to mips, just print Tac
+  PassManager passes(this, code);
+  passes.Run();
+
+  if (IsDebugOn("cfg")) { // print each function as its flow graph
+    std::list<Instruction*>::iterator p;
+    for (p = code.begin(); p != code.end(); ++p) {
+      if (dynamic_cast<BeginFunc*>(*p)) {
+        FlowGraph(FlowGraph::FunctionAt(p)).Print();
+        while (!dynamic_cast<EndFunc*>(*p)) ++p;
+      } else
+        (*p)->Print();
+    }
+  } else if (IsDebugOn("ssa") && passes.PrintedSSA()) { // printed by the PassManager
+  } else if (IsDebugOn("tac") || IsDebugOn("ssa")) { // if debug don't translate to mips, just print Tac
     std::list<Instruction*>::iterator p;
     for (p= code.begin(); p != code.end(); ++p) {
       (*p)->Print();
@@ -220,8 +456,11 @@ void CodeGenerator::DoFinalCodeGen()
 
     std::list<Instruction*>::iterator p;
     for (p= code.begin(); p != code.end(); ++p) {
+      if (GetOptimizationLevel() > 0 && dynamic_cast<BeginFunc*>(*p))
+        mips.AllocateRegisters(FlowGraph::FunctionAt(p));
       (*p)->Emit(&mips);
     }
+    mips.EmitDataSection();
   }
 }
 
@@ -16,6 +16,7 @@
 
 #include <cstdlib>
 #include <list>
+#include <map>
 #include "tac.h"
  
 
@@ -29,6 +30,15 @@ class CodeGenerator {
 	int Locals;
 	int Temps;
 	int Globals;
+
+         // the temps holding a known integer constant (from
+         // GenLoadConstant), used to fold and pick immediate forms
+    std::map<Location*, int> constants;
+    bool IsConstant(Location *var, int *value);
+    Location *GenOp(BinaryOp::OpCode code, Location *op1, Location *op2);
+    Location *GenOp(BinaryOp::OpCode code, Location *op1, int imm);
+    Location *GenStrengthReduced(BinaryOp::OpCode code, Location *x, int c);
+    Location *GenDivide(Location *x, int c);
 	
   public:
            // Here are some class constants to remind you of the offsets
@@ -48,6 +58,10 @@ class CodeGenerator {
 
     static Location* ThisPtr;
 
+         // Computes "a code b" as the MIPS code would, false if that
+         // would trap or isn't defined (then it is left for run time)
+    static bool FoldConstants(BinaryOp::OpCode code, int a, int b, int *result);
+
     CodeGenerator();
    
     void ResetLocalsAndTemps(){ Temps = Locals = 0;}
@@ -55,7 +69,7 @@ class CodeGenerator {
 
          // Assigns a new unique label name and returns it. Does not
          // generate any Tac instructions (see GenLabel below if needed)
-    char *NewLabel();
+    static char *NewLabel();
 
          // Creates and returns a Location for a local variable. 
 		 // Does not generate any Tac instructions
@@ -102,11 +116,20 @@ class CodeGenerator {
          // negative number of bytes. If not given, 0 is assumed.
     Location *GenLoad(Location *addr, int offset = 0);
 
+         // Generates a Load of the first word of obj that is only there
+         // to fault if obj is null, as the vtable load of a virtual call
+         // would. It is kept even though nothing uses what it reads.
+    void GenNullCheck(Location *obj);
+
     
          // Generates Tac instructions to perform one of the binary ops
          // identified by string name, such as "+" or "==".  Returns a
          // Location object for the new temporary where the result
-         // was stored.
+         // was stored. When optimizing, an op on two constants is
+         // folded to a single constant, a small constant operand
+         // is kept as an immediate instead of being loaded, and
+         // multiply/divide/modulo by a constant become shifts or a
+         // multiply by a "magic" reciprocal.
     Location *GenBinaryOp(const char *opName, Location *op1, Location *op2);
 
     
@@ -147,13 +170,24 @@ class CodeGenerator {
          // is created and NULL is returned.
     Location *GenBuiltInCall(BuiltIn b, Location *arg1 = NULL, Location *arg2 = NULL);
 
+         // Generate the runtime checks of an array subscript against
+         // the array's length and of the size of a new array, which
+         // stop the program with the error if they fail. A size check
+         // of a constant is left out when optimizing.
+    void GenBoundsCheck(Location *index, Location *length);
+    void GenSizeCheck(Location *size);
+
     
          // These methods generate the Tac instructions for various
          // control flow (branches, jumps, returns, labels)
          // One minor detail to mention is that you can pass NULL
          // (or omit arg) to GenReturn for a return that does not
-         // return a value
+         // return a value. GenIfCmp branches if "op1 rel op2" holds;
+         // when optimizing, a constant operand is kept as an immediate
+         // and a comparison of two constants becomes a Goto or nothing.
     void GenIfZ(Location *test, const char *label);
+    void GenIfCmp(IfCmp::Relation rel, Location *op1, Location *op2,
+                  const char *label);
     void GenGoto(const char *label);
     void GenReturn(Location *val = NULL);
     void GenLabel(const char *label);
@@ -173,7 +207,13 @@ class CodeGenerator {
     void GenVTable(const char *className, List<const char*> *methodLabels);
 
 
-         // Emits the final "object code" for the program by
+         // Deletes the loads of constants into temps that folding
+         // and immediate operands left unread (a pass of -O1 and up,
+         // see passmanager.h).
+    void RemoveUnusedConstants();
+
+         // Runs the optimization passes (see passmanager.h), then
+         // emits the final "object code" for the program by
          // translating the sequence of Tac instructions into their mips
          // equivalent and printing them out to stdout. If the debug
          // flag tac is on (-d tac), it will not translate to MIPS,
@@ -0,0 +1,353 @@
+/* File: constprop.cc
+ * ------------------
+ * Sparse conditional constant propagation (Wegman and Zadeck).
+ *
+ * Every SSA variable starts out Unknown (no definition seen yet), can
+ * become a Constant, and then Varying (not the same value every time)
+ * but never goes back up. Only the blocks reached over edges found to
+ * be executable are evaluated, starting from the entry: a branch on a
+ * Constant test makes only one of its edges executable. A phi meets
+ * the values coming in on executable edges only, so a variable that is
+ * constant along every path that can actually be taken stays Constant.
+ * Whenever a variable's value drops, the instructions reading it are
+ * evaluated again, until nothing changes.
+ */
+
+#include "optimize.h"
+#include "codegen.h"
+#include "mips.h"
+#include <cstring>
+#include <set>
+
+
+class ConstantPropagation
+{
+  public:
+    ConstantPropagation(FlowGraph *graph);
+    void Run();
+    bool Rewrite();
+
+  private:
+    typedef enum { Unknown, Constant, Varying } Kind;
+    struct Value {
+      Kind kind;
+      int c;
+      bool operator!=(const Value &v) const { return kind != v.kind || c != v.c; }
+    };
+
+    FlowGraph *graph;
+    std::map<Location*, Value> values;
+    std::map<Location*, std::vector<Instruction*> > uses;
+    std::map<Instruction*, BasicBlock*> blockOf;
+    std::vector<bool> reached;                  // per block id
+    bool branchesChanged;                       // by Rewrite
+    std::set<std::pair<int,int> > executable;   // edges as block ids
+    std::vector<std::pair<int,int> > edgeWork;
+    std::vector<Instruction*> instrWork;
+
+    Value ValueOf(Location *var);
+    bool IsConstant(Location *var, int *c);
+    Value Evaluate(Instruction *instr, BasicBlock *b);
+    void Visit(Instruction *instr, BasicBlock *b);
+    void VisitBranch(BasicBlock *b);
+    void AddEdge(BasicBlock *from, BasicBlock *to);
+    BasicBlock *Target(BasicBlock *b);
+    void RewriteInstruction(BasicBlock *b, int i);
+    void ResolveBranch(BasicBlock *b, int i, bool taken);
+    void RemoveUnusedConstants();
+};
+
+static const char *BranchTarget(BasicBlock *b)
+{
+  return b->code.empty() ? NULL : FlowGraph::BranchTarget(b->Last());
+}
+
+ConstantPropagation::ConstantPropagation(FlowGraph *g)
+  : graph(g), reached(g->blocks.size(), false), branchesChanged(false)
+{
+  Value unknown = {Unknown, 0};
+  for (int b = 0; b < graph->blocks.size(); b++) {
+    std::vector<Instruction*> &code = graph->blocks[b]->code;
+    for (int i = 0; i < code.size(); i++) {
+      blockOf[code[i]] = graph->blocks[b];
+      if (SSA::IsRenamed(code[i]->GetDst()))
+        values[code[i]->GetDst()] = unknown;
+      for (int s = 0; s < code[i]->NumSrcs(); s++)
+        if (SSA::IsRenamed(code[i]->GetSrc(s)))
+          uses[code[i]->GetSrc(s)].push_back(code[i]);
+    }
+  }
+}
+
+// Variables with no definition in the function (parameters, globals
+// and the entry value of locals) are Varying.
+ConstantPropagation::Value ConstantPropagation::ValueOf(Location *var)
+{
+  std::map<Location*, Value>::iterator it = values.find(var);
+  if (it != values.end()) return it->second;
+  Value varying = {Varying, 0};
+  return varying;
+}
+
+bool ConstantPropagation::IsConstant(Location *var, int *c)
+{
+  Value v = ValueOf(var);
+  *c = v.c;
+  return v.kind == Constant;
+}
+
+void ConstantPropagation::AddEdge(BasicBlock *from, BasicBlock *to)
+{
+  edgeWork.push_back(std::make_pair(from->id, to->id));
+}
+
+// The block a block's branch jumps to.
+BasicBlock *ConstantPropagation::Target(BasicBlock *b)
+{
+  const char *label = BranchTarget(b);
+  for (int s = 0; s < b->succs.size(); s++)
+    if (b->succs[s]->GetLabel() && !strcmp(b->succs[s]->GetLabel(), label))
+      return b->succs[s];
+  Assert(0);
+  return NULL;
+}
+
+void ConstantPropagation::Run()
+{
+  edgeWork.push_back(std::make_pair(-1, graph->Entry()->id));
+  while (!edgeWork.empty() || !instrWork.empty()) {
+    if (!edgeWork.empty()) {
+      std::pair<int,int> edge = edgeWork.back();
+      edgeWork.pop_back();
+      if (executable.count(edge)) continue;
+      executable.insert(edge);
+      BasicBlock *b = graph->blocks[edge.second];
+      bool first = !reached[b->id];
+      reached[b->id] = true;
+      for (int i = 0; i < b->code.size(); i++)
+        if (first || dynamic_cast<Phi*>(b->code[i]))
+          Visit(b->code[i], b);
+      if (first) VisitBranch(b);
+    } else {
+      Instruction *instr = instrWork.back();
+      instrWork.pop_back();
+      BasicBlock *b = blockOf[instr];
+      if (!reached[b->id]) continue;
+      Visit(instr, b);
+      if (instr == b->Last() && BranchTarget(b))
+        VisitBranch(b);
+    }
+  }
+}
+
+/* Method: Evaluate
+ * ----------------
+ * The value an instruction gives its destination with the values its
+ * operands have now. Anything loaded from memory or returned by a call
+ * is Varying, as is a fold that would trap at run time.
+ */
+ConstantPropagation::Value ConstantPropagation::Evaluate(Instruction *instr, BasicBlock *b)
+{
+  Value result = {Varying, 0};
+  if (LoadConstant *lc = dynamic_cast<LoadConstant*>(instr)) {
+    result.kind = Constant;
+    result.c = lc->GetValue();
+  } else if (dynamic_cast<Assign*>(instr)) {
+    result = ValueOf(instr->GetSrc(0));
+  } else if (BinaryOp *op = dynamic_cast<BinaryOp*>(instr)) {
+    Value a = ValueOf(op->GetSrc(0)), v;
+    if (op->HasImmediate()) {
+      v.kind = Constant;
+      v.c = op->GetImmediate();
+    } else
+      v = ValueOf(op->GetSrc(1));
+    if (a.kind == Unknown || v.kind == Unknown)
+      result.kind = Unknown;
+    else if (a.kind == Constant && v.kind == Constant
+             && CodeGenerator::FoldConstants(op->GetOpCode(), a.c, v.c, &result.c))
+      result.kind = Constant;
+  } else if (dynamic_cast<Phi*>(instr)) {
+    result.kind = Unknown;
+    for (int p = 0; p < b->preds.size(); p++) {
+      if (!executable.count(std::make_pair(b->preds[p]->id, b->id))) continue;
+      Value arg = ValueOf(instr->GetSrc(p));
+      if (arg.kind == Unknown) continue;
+      if (result.kind == Unknown)
+        result = arg;
+      else if (arg != result)
+        result.kind = Varying;
+    }
+  }
+  return result;
+}
+
+void ConstantPropagation::Visit(Instruction *instr, BasicBlock *b)
+{
+  Location *dst = instr->GetDst();
+  if (!SSA::IsRenamed(dst)) return;
+  Value v = Evaluate(instr, b);
+  if (v.kind != Constant) v.c = 0;
+  if (!(v != values[dst])) return;
+  values[dst] = v;
+  std::vector<Instruction*> &readers = uses[dst];
+  instrWork.insert(instrWork.end(), readers.begin(), readers.end());
+}
+
+// Makes the edges out of b executable: both for a test whose value is
+// Varying, only the one taken for a Constant one, none yet for an
+// Unknown one. A block not ending in a test falls through or jumps.
+void ConstantPropagation::VisitBranch(BasicBlock *b)
+{
+  Instruction *last = b->Last();
+  bool known = false, taken = false;
+  if (IfZ *z = dynamic_cast<IfZ*>(last)) {
+    Value test = ValueOf(z->GetSrc(0));
+    if (test.kind == Unknown) return;
+    known = (test.kind == Constant);
+    taken = (test.c == 0);
+  } else if (IfCmp *cmp = dynamic_cast<IfCmp*>(last)) {
+    Value v1 = ValueOf(cmp->GetSrc(0)), v2;
+    if (cmp->HasImmediate()) {
+      v2.kind = Constant;
+      v2.c = cmp->GetImmediate();
+    } else
+      v2 = ValueOf(cmp->GetSrc(1));
+    if (v1.kind == Unknown || v2.kind == Unknown) return;
+    known = (v1.kind == Constant && v2.kind == Constant);
+    taken = IfCmp::Holds(cmp->GetRelation(), v1.c, v2.c);
+  }
+  if (!known) {
+    for (int s = 0; s < b->succs.size(); s++)
+      AddEdge(b, b->succs[s]);
+  } else if (taken) {
+    AddEdge(b, Target(b));
+  } else if (b->id + 1 < graph->blocks.size()) {
+    AddEdge(b, graph->blocks[b->id + 1]);
+  }
+}
+
+/* Method: Rewrite
+ * ---------------
+ * Makes the code use what was found. Each Constant variable is set by
+ * a LoadConstant (those set by a phi get it after the block's phis),
+ * constant second operands become immediates, and a test with a known
+ * outcome becomes a Goto or goes away. Only reached blocks are changed;
+ * the others are deleted once the edges have been found again, along
+ * with the LoadConstants no longer read and the Gotos that now go to
+ * the next block. Returns true if the branches or blocks changed.
+ */
+bool ConstantPropagation::Rewrite()
+{
+  for (int b = 0; b < graph->blocks.size(); b++) {
+    if (!reached[b]) {
+      branchesChanged = true;
+      continue;
+    }
+    BasicBlock *block = graph->blocks[b];
+    std::vector<Instruction*> &code = block->code;
+    std::vector<Instruction*> loads;
+    int i = block->GetLabel() ? 1 : 0;
+    while (i < code.size() && dynamic_cast<Phi*>(code[i])) {
+      int c;
+      if (IsConstant(code[i]->GetDst(), &c)) {
+        loads.push_back(new LoadConstant(code[i]->GetDst(), c));
+        code.erase(code.begin() + i);
+      } else
+        i++;
+    }
+    code.insert(code.begin() + i, loads.begin(), loads.end());
+    for (i += loads.size(); i < code.size(); i++)
+      RewriteInstruction(block, i);
+  }
+  if (branchesChanged) {
+    graph->FindEdges();
+    graph->RemoveUnreachableBlocks();
+  }
+  RemoveUnusedConstants();
+  graph->RemoveJumpsToNext();
+  return branchesChanged;
+}
+
+static bool Commutes(BinaryOp::OpCode code)
+{
+  return code == BinaryOp::Add || code == BinaryOp::Mul || code == BinaryOp::Eq
+    || code == BinaryOp::And || code == BinaryOp::Or || code == BinaryOp::AddU;
+}
+
+void ConstantPropagation::RewriteInstruction(BasicBlock *b, int i)
+{
+  Instruction *instr = b->code[i];
+  Location *dst = instr->GetDst();
+  int c, c1, c2;
+  if (SSA::IsRenamed(dst) && IsConstant(dst, &c)) {
+    if (!dynamic_cast<LoadConstant*>(instr))
+      b->code[i] = new LoadConstant(dst, c);
+  } else if (BinaryOp *op = dynamic_cast<BinaryOp*>(instr)) {
+    if (op->HasImmediate()) return;
+    BinaryOp::OpCode code = op->GetOpCode();
+    Location *x = op->GetSrc(0), *y = op->GetSrc(1);
+    if (IsConstant(x, &c1) && !IsConstant(y, &c2) && Commutes(code)) {
+      std::swap(x, y);
+      c2 = c1;
+    }
+    if (IsConstant(y, &c2) && Mips::HasImmediateForm(code, c2))
+      b->code[i] = new BinaryOp(code, dst, x, c2);
+  } else if (dynamic_cast<IfZ*>(instr)) {
+    if (!IsConstant(instr->GetSrc(0), &c)) return;
+    ResolveBranch(b, i, c == 0);
+  } else if (IfCmp *cmp = dynamic_cast<IfCmp*>(instr)) {
+    IfCmp::Relation rel = cmp->GetRelation();
+    Location *x = cmp->GetSrc(0), *y = cmp->HasImmediate() ? NULL : cmp->GetSrc(1);
+    bool isConst1 = IsConstant(x, &c1);
+    bool isConst2 = y ? IsConstant(y, &c2) : (c2 = cmp->GetImmediate(), true);
+    if (isConst1 && isConst2) {
+      ResolveBranch(b, i, IfCmp::Holds(rel, c1, c2));
+      return;
+    }
+    if (isConst1) {
+      std::swap(x, y);
+      c2 = c1;
+      rel = IfCmp::Reverse(rel);
+      isConst2 = true;
+    }
+    if (y && isConst2 && c2 >= -32768 && c2 <= 32767)
+      b->code[i] = new IfCmp(rel, x, c2, BranchTarget(b));
+  }
+}
+
+// Replaces the test at b->code[i] by a Goto if taken, deletes it if not.
+void ConstantPropagation::ResolveBranch(BasicBlock *b, int i, bool taken)
+{
+  branchesChanged = true;
+  if (taken)
+    b->code[i] = new Goto(BranchTarget(b));
+  else
+    b->code.erase(b->code.begin() + i);
+}
+
+// Deletes the LoadConstants whose variable nothing reads any more,
+// typically the operands of what was folded.
+void ConstantPropagation::RemoveUnusedConstants()
+{
+  std::set<Location*> read;
+  for (int b = 0; b < graph->blocks.size(); b++) {
+    std::vector<Instruction*> &code = graph->blocks[b]->code;
+    for (int i = 0; i < code.size(); i++)
+      for (int s = 0; s < code[i]->NumSrcs(); s++)
+        read.insert(code[i]->GetSrc(s));
+  }
+  for (int b = 0; b < graph->blocks.size(); b++) {
+    std::vector<Instruction*> &code = graph->blocks[b]->code;
+    for (int i = 0; i < code.size(); i++)
+      if (dynamic_cast<LoadConstant*>(code[i]) && SSA::IsRenamed(code[i]->GetDst())
+          && !read.count(code[i]->GetDst()))
+        code.erase(code.begin() + i--);
+  }
+}
+
+bool PropagateConstants(FlowGraph *graph)
+{
+  ConstantPropagation pass(graph);
+  pass.Run();
+  return pass.Rewrite();
+}
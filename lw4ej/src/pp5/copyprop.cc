@@ -0,0 +1,78 @@
+/* File: copyprop.cc
+ * -----------------
+ * Copy propagation on SSA form. As each SSA variable is set exactly
+ * once and the variable it copies can't change either, every read of
+ * the copy can read the copied variable instead.
+ */
+
+#include "optimize.h"
+
+
+static Location *Resolve(std::map<Location*, Location*> &copyOf, Location *var)
+{
+  std::map<Location*, Location*>::iterator it;
+  while ((it = copyOf.find(var)) != copyOf.end())
+    var = it->second;
+  return var;
+}
+
+// A phi is a copy if all its arguments but itself are the same var.
+static Location *PhiCopies(Phi *phi, std::map<Location*, Location*> &copyOf)
+{
+  Location *dst = phi->GetDst(), *same = NULL;
+  for (int i = 0; i < phi->NumSrcs(); i++) {
+    Location *arg = Resolve(copyOf, phi->GetSrc(i));
+    if (arg == dst || arg == same) continue;
+    if (same) return NULL;
+    same = arg;
+  }
+  return same;
+}
+
+/* Function: PropagateCopies
+ * -------------------------
+ * Finds the copies between SSA variables (globals may change, so a copy
+ * of one isn't propagated), counting a phi whose arguments are all the
+ * same variable as one. Finding one can make more phis copies, so the
+ * phis are looked at again until no new copy turns up. Then each read
+ * is redirected to the end of its chain of copies and the copies, no
+ * longer read, are deleted.
+ */
+void PropagateCopies(FlowGraph *graph)
+{
+  std::vector<BasicBlock*> &blocks = graph->blocks;
+  std::map<Location*, Location*> copyOf;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int b = 0; b < blocks.size(); b++) {
+      std::vector<Instruction*> &code = blocks[b]->code;
+      for (int i = 0; i < code.size(); i++) {
+        Location *dst = code[i]->GetDst(), *src = NULL;
+        if (!SSA::IsRenamed(dst) || copyOf.count(dst)) continue;
+        if (dynamic_cast<Assign*>(code[i]))
+          src = code[i]->GetSrc(0);
+        else if (Phi *phi = dynamic_cast<Phi*>(code[i]))
+          src = PhiCopies(phi, copyOf);
+        if (SSA::IsRenamed(src) && Resolve(copyOf, src) != dst) {
+          copyOf[dst] = src;
+          changed = true;
+        }
+      }
+    }
+  }
+  if (copyOf.empty()) return;
+
+  for (int b = 0; b < blocks.size(); b++) {
+    std::vector<Instruction*> &code = blocks[b]->code;
+    for (int i = 0; i < code.size(); i++) {
+      if (copyOf.count(code[i]->GetDst())) {
+        code.erase(code.begin() + i--);
+        continue;
+      }
+      for (int s = 0; s < code[i]->NumSrcs(); s++)
+        if (copyOf.count(code[i]->GetSrc(s)))
+          code[i]->SetSrc(s, Resolve(copyOf, code[i]->GetSrc(s)));
+    }
+  }
+}
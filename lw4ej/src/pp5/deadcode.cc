@@ -0,0 +1,71 @@
+/* File: deadcode.cc
+ * -----------------
+ * Dead code elimination on SSA form.
+ */
+
+#include "optimize.h"
+#include <set>
+
+
+// The instructions with no effect but setting their destination, an
+// SSA variable. Add and Sub stay, as they stop the program on
+// overflow, and so do Div and Mod, as dividing by zero does; a Load
+// is assumed to be through a valid pointer, except one made to check
+// that an object isn't null.
+static bool IsPure(Instruction *instr)
+{
+  if (!SSA::IsRenamed(instr->GetDst())) return false;
+  if (Load *load = dynamic_cast<Load*>(instr))
+    return !load->ChecksNull();
+  if (BinaryOp *op = dynamic_cast<BinaryOp*>(instr)) {
+    BinaryOp::OpCode code = op->GetOpCode();
+    return code != BinaryOp::Div && code != BinaryOp::Mod
+      && code != BinaryOp::Add && code != BinaryOp::Sub;
+  }
+  return dynamic_cast<Assign*>(instr) || dynamic_cast<LoadConstant*>(instr)
+    || dynamic_cast<LoadStringConstant*>(instr) || dynamic_cast<LoadLabel*>(instr)
+    || dynamic_cast<Phi*>(instr);
+}
+
+/* Function: EliminateDeadCode
+ * ---------------------------
+ * Mark and sweep: every instruction that isn't pure is live, as is the
+ * definition of every variable a live instruction reads. Since each
+ * SSA variable has a single definition, following the reads from the
+ * live instructions finds all live ones in one pass over a worklist;
+ * the pure instructions left unmarked, including chains and cycles of
+ * phis feeding only each other, are deleted.
+ */
+void EliminateDeadCode(FlowGraph *graph)
+{
+  std::vector<BasicBlock*> &blocks = graph->blocks;
+  std::map<Location*, Instruction*> definition;
+  std::vector<Instruction*> work;
+  for (int b = 0; b < blocks.size(); b++) {
+    std::vector<Instruction*> &code = blocks[b]->code;
+    for (int i = 0; i < code.size(); i++) {
+      if (SSA::IsRenamed(code[i]->GetDst()))
+        definition[code[i]->GetDst()] = code[i];
+      if (!IsPure(code[i]))
+        work.push_back(code[i]);
+    }
+  }
+
+  std::set<Instruction*> live(work.begin(), work.end());
+  while (!work.empty()) {
+    Instruction *instr = work.back();
+    work.pop_back();
+    for (int s = 0; s < instr->NumSrcs(); s++) {
+      std::map<Location*, Instruction*>::iterator def = definition.find(instr->GetSrc(s));
+      if (def != definition.end() && live.insert(def->second).second)
+        work.push_back(def->second);
+    }
+  }
+
+  for (int b = 0; b < blocks.size(); b++) {
+    std::vector<Instruction*> &code = blocks[b]->code;
+    for (int i = 0; i < code.size(); i++)
+      if (!live.count(code[i]))
+        code.erase(code.begin() + i--);
+  }
+}
@@ -0,0 +1,116 @@
+/* File: devirtualize.cc
+ * ---------------------
+ * Turning ACalls into LCalls when the object's class is known, on the
+ * Tac of the whole program before calls are inlined.
+ *
+ * Call::Emit already calls a method by its label when no class extending
+ * the receiver's declared class overrides it (see
+ * ClassDecl::FinalMethodLabel), keeping a null check on the receiver
+ * where the vtable load would have faulted. The ACalls left go through the vtable
+ * word of an object, the method's address loaded from it at the
+ * method's offset. When the object was created in the same function,
+ * by an _Alloc whose first word is then set to the label of a class's
+ * vtable, the method called is the one that vtable has at that offset.
+ *
+ * Only variables assigned once in the function are followed: whenever
+ * one of them holds a value it is the one of its only assignment. The
+ * vtable word of an object is never written again after its NewExpr.
+ * The vtable loads of a call replaced are left for dead code
+ * elimination, since an object just allocated can't be null.
+ */
+
+#include "optimize.h"
+#include "codegen.h"
+#include <cstring>
+#include <string>
+
+
+typedef std::map<Location*, Instruction*> Definitions;
+
+// The instruction assigning each local or temp of the function starting
+// at begin, NULL for the ones assigned more than once.
+static void FindDefinitions(std::list<Instruction*>::iterator begin, Definitions &defs)
+{
+  std::list<Instruction*>::iterator p = begin;
+  do {
+    Location *dst = (*p)->GetDst();
+    if (dst && dst->GetSegment() == fpRelative && dst->GetOffset() < 0)
+      defs[dst] = defs.count(dst) ? NULL : *p;
+  } while (!dynamic_cast<EndFunc*>(*p++));
+}
+
+// The instruction giving var its value, through the Assigns copying it,
+// or NULL if there isn't a single one.
+static Instruction *DefinitionOf(Location *var, Definitions &defs)
+{
+  for (int steps = 0; steps <= defs.size(); steps++) {
+    Definitions::iterator def = defs.find(var);
+    if (def == defs.end() || def->second == NULL) return NULL;
+    Assign *copy = dynamic_cast<Assign*>(def->second);
+    if (!copy) return def->second;
+    var = copy->GetSrc(0);
+  }
+  return NULL;                                   // copies going round
+}
+
+static bool IsAlloc(Instruction *instr)
+{
+  LCall *call = dynamic_cast<LCall*>(instr);
+  return call && call->IsBuiltIn() && strcmp(call->GetLabel(), "_Alloc") == 0;
+}
+
+/* Function: DevirtualizeFunction
+ * ------------------------------
+ * Replaces the ACalls of the function starting at begin whose object
+ * comes from one of its _Allocs with a known vtable.
+ */
+static void DevirtualizeFunction(std::list<Instruction*>::iterator begin,
+                                 std::map<std::string, VTable*> &vtables)
+{
+  Definitions defs;
+  FindDefinitions(begin, defs);
+
+  // the vtable of each object allocated, NULL if its first word is
+  // written anything else or more than once
+  std::map<Instruction*, VTable*> classOf;
+  std::list<Instruction*>::iterator p = begin;
+  do {
+    Store *store = dynamic_cast<Store*>(*p);
+    if (!store || store->GetOffset() != 0) continue;
+    Instruction *object = DefinitionOf(store->GetSrc(0), defs);
+    if (!IsAlloc(object)) continue;
+    LoadLabel *value = dynamic_cast<LoadLabel*>(DefinitionOf(store->GetSrc(1), defs));
+    VTable *vtable = NULL;
+    if (value && vtables.count(value->GetLabel()) && !classOf.count(object))
+      vtable = vtables[value->GetLabel()];
+    classOf[object] = vtable;
+  } while (!dynamic_cast<EndFunc*>(*p++));
+
+  for (p = begin; !dynamic_cast<EndFunc*>(*p); ++p) {
+    ACall *call = dynamic_cast<ACall*>(*p);
+    if (!call) continue;
+    Load *method = dynamic_cast<Load*>(DefinitionOf(call->GetSrc(0), defs));
+    Load *vtableWord = method ? dynamic_cast<Load*>(DefinitionOf(method->GetSrc(0), defs)) : NULL;
+    if (!vtableWord || vtableWord->GetOffset() != 0) continue;
+    Instruction *object = DefinitionOf(vtableWord->GetSrc(0), defs);
+    if (!classOf.count(object) || classOf[object] == NULL) continue;
+    List<const char*> *methods = classOf[object]->GetMethodLabels();
+    int n = method->GetOffset() / CodeGenerator::VarSize;
+    if (method->GetOffset() % CodeGenerator::VarSize != 0 || n < 0 || n >= methods->NumElements())
+      continue;
+    *p = new LCall(methods->Nth(n), call->GetDst());
+  }
+}
+
+void DevirtualizeCalls(std::list<Instruction*> &code)
+{
+  std::map<std::string, VTable*> vtables;
+  std::list<Instruction*>::iterator p;
+  for (p = code.begin(); p != code.end(); ++p)
+    if (VTable *vtable = dynamic_cast<VTable*>(*p))
+      vtables[vtable->GetLabel()] = vtable;
+
+  for (p = code.begin(); p != code.end(); ++p)
+    if (dynamic_cast<BeginFunc*>(*p))
+      DevirtualizeFunction(p, vtables);
+}
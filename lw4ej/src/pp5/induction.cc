@@ -0,0 +1,482 @@
+/* File: induction.cc
+ * ------------------
+ * Strength reduction of array element addresses on SSA form.
+ *
+ * A basic induction variable is a phi in a loop header that goes up or
+ * down by the same constant in every iteration: all its arguments from
+ * inside the loop are the one variable "i + c". The address of a[i] is
+ * a + (i << 2), so in each iteration it goes up by 4 * c as well. Such
+ * an address, or any other variable computed from an induction variable
+ * and a loop invariant by adding constants, shifting and multiplying by
+ * constants, is worked out as base + scale * i + offset. The addresses
+ * with the same induction variable, base and scale are replaced by one
+ * new pointer: a phi in the header starting at base + scale * init in
+ * the preheader and going up by scale * c next to i's increment, with
+ * what each address adds to it going into the offset of the Loads and
+ * Stores through it. The shift and add computing the address in each
+ * iteration are dead code then.
+ *
+ * Only addresses computed in every iteration (in a block on the way to
+ * every back edge) and only read as the address of Loads and Stores in
+ * the loop are replaced, so the pointer takes the values the addresses
+ * took, plus one past the last. The pointer starts at the smallest of
+ * the addresses, so the offsets stay positive: negative ones are left
+ * to the array lengths (see memory.cc).
+ *
+ * If what is left of i after that is its increment and the tests of
+ * the loop against a constant or the length of the array the pointer
+ * goes through, the tests are made on the pointer instead, against the
+ * address that i's bound stands for, and i is dead code too.
+ */
+
+#include "optimize.h"
+#include "mips.h"
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <set>
+
+
+class InductionVariables
+{
+  public:
+    InductionVariables(FlowGraph *graph, SSA *ssa);
+    void Run();
+
+  private:
+    struct BasicIV {
+      Loop *loop;
+      Location *init;                   // value on entry to the loop
+      Location *next;                   // value for the next iteration
+      int step;
+    };
+    struct Affine {                     // base + scale * iv + offset
+      Location *iv, *base;
+      long long scale, offset;
+    };
+    struct Family {
+      Location *iv, *base;
+      int scale;
+      BasicBlock *preheader;
+      Location *pointer, *pointerNext;
+      long long offset;                 // what pointer adds to base + scale * iv
+    };
+
+    FlowGraph *graph;
+    SSA *ssa;
+    std::map<Location*, Instruction*> definition;
+    std::map<Location*, BasicBlock*> blockOf;
+    std::map<Location*, BasicIV> ivs;
+    std::vector<Family> families;
+
+    void FindDefinitions();
+    BasicBlock *PreheaderOf(Loop *loop);
+    void FindBasicIVs(Loop *loop, BasicBlock *preheader);
+    bool IsInvariant(Location *var, Loop *loop);
+    bool IsConstant(Location *var, int *value);
+    bool AffineOf(Location *var, Loop *loop, Affine *a);
+    void Insert(Instruction *instr, BasicBlock *preheader);
+    Location *AddScaled(BasicBlock *preheader, Location *base, long long scale,
+                        Location *var, long long c, Location *like);
+    void Reduce(Loop *loop, BasicBlock *preheader);
+    bool ReplaceTests(const Family &f);
+};
+
+InductionVariables::InductionVariables(FlowGraph *g, SSA *s) : graph(g), ssa(s) {}
+
+static int PhiPosition(BasicBlock *b)
+{
+  return b->GetLabel() ? 1 : 0;
+}
+
+// Keeps the constants in an address small enough that adding them
+// can't take a heap address out of range.
+static bool IsSmall(long long value)
+{
+  return llabs(value) <= (1 << 24);
+}
+
+void InductionVariables::FindDefinitions()
+{
+  definition.clear();
+  blockOf.clear();
+  for (int b = 0; b < graph->blocks.size(); b++) {
+    std::vector<Instruction*> &code = graph->blocks[b]->code;
+    for (int i = 0; i < code.size(); i++)
+      if (SSA::IsRenamed(code[i]->GetDst())) {
+        definition[code[i]->GetDst()] = code[i];
+        blockOf[code[i]->GetDst()] = graph->blocks[b];
+      }
+  }
+}
+
+// The loop's only way in from outside, if that block goes nowhere else
+// (as after loop-invariant code motion made it a preheader).
+BasicBlock *InductionVariables::PreheaderOf(Loop *loop)
+{
+  BasicBlock *preheader = NULL;
+  std::vector<BasicBlock*> &preds = loop->header->preds;
+  for (int p = 0; p < preds.size(); p++)
+    if (!loop->Contains(preds[p])) {
+      if (preheader) return NULL;
+      preheader = preds[p];
+    }
+  return (preheader && preheader->succs.size() == 1) ? preheader : NULL;
+}
+
+void InductionVariables::FindBasicIVs(Loop *loop, BasicBlock *preheader)
+{
+  BasicBlock *header = loop->header;
+  for (int i = PhiPosition(header); i < header->code.size(); i++) {
+    Phi *phi = dynamic_cast<Phi*>(header->code[i]);
+    if (!phi) break;
+    BasicIV iv = { loop, NULL, NULL, 0 };
+    bool same = true;
+    for (int p = 0; p < header->preds.size() && same; p++) {
+      if (header->preds[p] == preheader)
+        iv.init = phi->GetSrc(p);
+      else if (!iv.next)
+        iv.next = phi->GetSrc(p);
+      else
+        same = (phi->GetSrc(p) == iv.next);
+    }
+    BinaryOp *op = dynamic_cast<BinaryOp*>(definition[iv.next]);
+    if (!same || !op || !op->HasImmediate() || op->GetSrc(0) != phi->GetDst()
+        || (op->GetOpCode() != BinaryOp::Add && op->GetOpCode() != BinaryOp::Sub))
+      continue;
+    iv.step = (op->GetOpCode() == BinaryOp::Add) ? op->GetImmediate() : -op->GetImmediate();
+    if (iv.step != 0) ivs[phi->GetDst()] = iv;
+  }
+}
+
+bool InductionVariables::IsInvariant(Location *var, Loop *loop)
+{
+  return SSA::IsRenamed(var) && (!blockOf.count(var) || !loop->Contains(blockOf[var]));
+}
+
+bool InductionVariables::IsConstant(Location *var, int *value)
+{
+  LoadConstant *lc = dynamic_cast<LoadConstant*>(definition[var]);
+  if (lc) *value = lc->GetValue();
+  return lc != NULL;
+}
+
+/* Method: AffineOf
+ * ----------------
+ * Works out var as base + scale * iv + offset for a basic induction
+ * variable iv of the loop and a loop invariant base (NULL if none),
+ * following the definitions of var inside the loop back to iv. Returns
+ * false if var can't be put that way.
+ */
+bool InductionVariables::AffineOf(Location *var, Loop *loop, Affine *a)
+{
+  std::map<Location*, BasicIV>::iterator iv = ivs.find(var);
+  if (iv != ivs.end() && iv->second.loop == loop) {
+    a->iv = var;
+    a->base = NULL;
+    a->scale = 1;
+    a->offset = 0;
+    return true;
+  }
+  BinaryOp *op = dynamic_cast<BinaryOp*>(definition[var]);
+  if (!op || !loop->Contains(blockOf[var])) return false;
+  Location *x = op->GetSrc(0), *y = op->HasImmediate() ? NULL : op->GetSrc(1);
+  int c;
+  switch (op->GetOpCode()) {
+    case BinaryOp::Add:
+    case BinaryOp::AddU:
+    case BinaryOp::Sub:
+      if (!y) {
+        if (!AffineOf(x, loop, a)) return false;
+        a->offset += (op->GetOpCode() != BinaryOp::Sub) ? op->GetImmediate()
+                                                        : -(long long)op->GetImmediate();
+        break;
+      }
+      if (op->GetOpCode() == BinaryOp::Sub) {       // c - iv, as in a[n - 1 - i]
+        if (!IsConstant(x, &c) || !AffineOf(y, loop, a) || a->base) return false;
+        a->scale = -a->scale;
+        a->offset = c - a->offset;
+        break;
+      }
+      if (IsInvariant(x, loop)) std::swap(x, y);
+      if (!IsInvariant(y, loop) || !AffineOf(x, loop, a) || a->base) return false;
+      a->base = y;
+      break;
+    case BinaryOp::Shl:
+      if (y || !AffineOf(x, loop, a) || a->base || op->GetImmediate() > 24) return false;
+      a->scale <<= op->GetImmediate();
+      a->offset <<= op->GetImmediate();
+      break;
+    case BinaryOp::Mul:
+      if (!y) return false;
+      if (IsConstant(x, &c)) std::swap(x, y);
+      if (!IsConstant(y, &c) || !AffineOf(x, loop, a) || a->base) return false;
+      a->scale *= c;
+      a->offset *= c;
+      break;
+    default:
+      return false;
+  }
+  return IsSmall(a->scale) && IsSmall(a->offset);
+}
+
+// Adds instr to the end of the preheader, before the branch if any.
+void InductionVariables::Insert(Instruction *instr, BasicBlock *preheader)
+{
+  std::vector<Instruction*> &code = preheader->code;
+  int pos = (!code.empty() && FlowGraph::EndsBlock(code.back()))
+            ? code.size() - 1 : code.size();
+  code.insert(code.begin() + pos, instr);
+}
+
+/* Method: AddScaled
+ * -----------------
+ * Computes base + scale * var + c in the preheader (base + c if var is
+ * NULL) into new versions of like, and returns the variable holding it.
+ * The preheader runs even if the loop body doesn't, where var may be
+ * far out of the array's range, so the adds wrap around, as the shift
+ * and multiply do, instead of trapping on a value never used.
+ */
+Location *InductionVariables::AddScaled(BasicBlock *preheader, Location *base, long long scale,
+                                        Location *var, long long c, Location *like)
+{
+  int value;
+  if (var && IsConstant(var, &value)) {
+    c += scale * value;
+    var = NULL;
+  }
+  Location *scaled = var;
+  if (var && scale != 1) {
+    scaled = ssa->NewVersion(like);
+    int shift = 0;
+    while ((1LL << shift) < scale) shift++;
+    if ((1LL << shift) == scale)
+      Insert(new BinaryOp(BinaryOp::Shl, scaled, var, shift), preheader);
+    else {
+      Location *factor = ssa->NewVersion(like);
+      Insert(new LoadConstant(factor, scale), preheader);
+      Insert(new BinaryOp(BinaryOp::Mul, scaled, var, factor), preheader);
+    }
+  }
+  if (scaled) {
+    Location *sum = ssa->NewVersion(like);
+    Insert(new BinaryOp(BinaryOp::AddU, sum, base, scaled), preheader);
+    base = sum;
+  }
+  if (c == 0) return base;
+  Location *sum = ssa->NewVersion(like);
+  if (Mips::HasImmediateForm(BinaryOp::AddU, c))
+    Insert(new BinaryOp(BinaryOp::AddU, sum, base, (int)c), preheader);
+  else {
+    Location *constant = ssa->NewVersion(like);
+    Insert(new LoadConstant(constant, c), preheader);
+    Insert(new BinaryOp(BinaryOp::AddU, sum, base, constant), preheader);
+  }
+  return sum;
+}
+
+/* Method: Reduce
+ * --------------
+ * Finds the addresses of the loop that are worth a pointer of their
+ * own, groups them by induction variable, base and scale, and gives
+ * each group its pointer.
+ */
+void InductionVariables::Reduce(Loop *loop, BasicBlock *preheader)
+{
+  std::map<Location*, std::vector<Instruction*> > uses;
+  for (int b = 0; b < graph->blocks.size(); b++) {
+    std::vector<Instruction*> &code = graph->blocks[b]->code;
+    for (int i = 0; i < code.size(); i++)
+      for (int s = 0; s < code[i]->NumSrcs(); s++)
+        uses[code[i]->GetSrc(s)].push_back(code[i]);
+  }
+  std::set<Instruction*> inLoop;
+  for (int b = 0; b < loop->blocks.size(); b++)
+    inLoop.insert(loop->blocks[b]->code.begin(), loop->blocks[b]->code.end());
+
+  typedef std::pair<std::pair<Location*, Location*>, long long> Key;
+  std::map<Key, int> groupOf;
+  std::vector<std::vector<std::pair<Location*, Affine> > > groups;
+  for (int b = 0; b < loop->blocks.size(); b++) {
+    BasicBlock *block = loop->blocks[b];
+    bool everyIteration = true;
+    for (int l = 0; l < loop->latches.size() && everyIteration; l++)
+      everyIteration = block->Dominates(loop->latches[l]);
+    for (int i = 0; i < block->code.size() && everyIteration; i++) {
+      Location *var = block->code[i]->GetDst();
+      Affine a;
+      if (!SSA::IsRenamed(var) || !dynamic_cast<BinaryOp*>(block->code[i])
+          || !AffineOf(var, loop, &a) || !a.base || a.scale == 0)
+        continue;
+      std::vector<Instruction*> &used = uses[var];
+      bool addressOnly = !used.empty();
+      for (int u = 0; u < used.size() && addressOnly; u++) {
+        Instruction *use = used[u];
+        addressOnly = inLoop.count(use) && (dynamic_cast<Load*>(use)
+                      || (dynamic_cast<Store*>(use) && use->GetSrc(1) != var));
+      }
+      if (!addressOnly) continue;
+      Key key(std::make_pair(a.iv, a.base), a.scale);
+      if (!groupOf.count(key)) {
+        groupOf[key] = groups.size();
+        groups.push_back(std::vector<std::pair<Location*, Affine> >());
+      }
+      groups[groupOf[key]].push_back(std::make_pair(var, a));
+    }
+  }
+
+  BasicBlock *header = loop->header;
+  for (int g = 0; g < groups.size(); g++) {
+    std::vector<std::pair<Location*, Affine> > &members = groups[g];
+    const Affine &a = members[0].second;
+    BasicIV &iv = ivs[a.iv];
+    long long step = a.scale * iv.step;
+    if (!Mips::HasImmediateForm(BinaryOp::AddU, step)) continue;
+
+    // the pointer starts at the smallest address read through, so the
+    // offsets of the Loads and Stores only go up
+    long long lowest = LLONG_MAX, highest = LLONG_MIN;
+    for (int m = 0; m < members.size(); m++) {
+      std::vector<Instruction*> &used = uses[members[m].first];
+      for (int u = 0; u < used.size(); u++) {
+        Load *load = dynamic_cast<Load*>(used[u]);
+        long long at = members[m].second.offset
+                       + (load ? load->GetOffset() : dynamic_cast<Store*>(used[u])->GetOffset());
+        lowest = std::min(lowest, at);
+        highest = std::max(highest, at);
+      }
+    }
+    if (highest - lowest > 32767) continue;
+
+    Family f;
+    f.iv = a.iv;
+    f.base = a.base;
+    f.scale = a.scale;
+    f.preheader = preheader;
+    f.offset = lowest;
+    Location *like = members[0].first;
+    f.pointer = ssa->NewVersion(like);
+    f.pointerNext = ssa->NewVersion(like);
+    Phi *phi = new Phi(f.pointer, header->preds.size());
+    for (int p = 0; p < header->preds.size(); p++)
+      phi->SetSrc(p, header->preds[p] == preheader
+                       ? AddScaled(preheader, f.base, f.scale, iv.init, lowest, like)
+                       : f.pointerNext);
+    header->code.insert(header->code.begin() + PhiPosition(header), phi);
+    std::vector<Instruction*> &code = blockOf[iv.next]->code;
+    code.insert(std::find(code.begin(), code.end(), definition[iv.next]) + 1,
+                new BinaryOp(BinaryOp::AddU, f.pointerNext, f.pointer, (int)step));
+
+    for (int m = 0; m < members.size(); m++) {
+      std::vector<Instruction*> &used = uses[members[m].first];
+      int delta = members[m].second.offset - lowest;
+      for (int u = 0; u < used.size(); u++) {
+        used[u]->SetSrc(0, f.pointer);
+        if (Load *load = dynamic_cast<Load*>(used[u]))
+          load->SetOffset(load->GetOffset() + delta);
+        else {
+          Store *store = dynamic_cast<Store*>(used[u]);
+          store->SetOffset(store->GetOffset() + delta);
+        }
+      }
+    }
+    families.push_back(f);
+  }
+}
+
+/* Method: ReplaceTests
+ * --------------------
+ * If the induction variable of the family and its next value are only
+ * left being compared, compares the pointer instead. The pointer is
+ * base + scale * i + offset, which goes up with i as scale is positive,
+ * so i rel n holds just when the pointer rel base + scale * n + offset
+ * does. That only stays true if base + scale * n doesn't overflow, so n
+ * has to be a small constant or the length of the array (when scale is
+ * that of its elements). The bound is computed in the preheader, so a
+ * length has to be loaded before the loop, not just outside it as for a
+ * test after the loop.
+ */
+bool InductionVariables::ReplaceTests(const Family &f)
+{
+  BasicIV &iv = ivs[f.iv];
+  if (f.scale <= 0) return false;
+  Instruction *increment = definition[iv.next];
+  std::vector<std::pair<BasicBlock*, int> > tests;
+  for (int b = 0; b < graph->blocks.size(); b++) {
+    std::vector<Instruction*> &code = graph->blocks[b]->code;
+    for (int i = 0; i < code.size(); i++) {
+      Instruction *instr = code[i];
+      bool reads = false;
+      for (int s = 0; s < instr->NumSrcs(); s++)
+        if (instr->GetSrc(s) == f.iv || instr->GetSrc(s) == iv.next) reads = true;
+      if (!reads || instr == increment || instr->GetDst() == f.iv) continue;
+      if (!dynamic_cast<IfCmp*>(instr)) return false;
+      tests.push_back(std::make_pair(graph->blocks[b], i));
+    }
+  }
+
+  struct Test { IfCmp::Relation rel; Location *pointer, *n; long long c; };
+  std::vector<Test> replaced;
+  for (int t = 0; t < tests.size(); t++) {
+    IfCmp *cmp = dynamic_cast<IfCmp*>(tests[t].first->code[tests[t].second]);
+    Location *x = cmp->GetSrc(0), *n = cmp->HasImmediate() ? NULL : cmp->GetSrc(1);
+    Test test = { cmp->GetRelation(), NULL, n, cmp->HasImmediate() ? cmp->GetImmediate() : 0 };
+    if (n == f.iv || n == iv.next) {
+      std::swap(x, test.n);
+      test.rel = IfCmp::Reverse(test.rel);
+    }
+    int value;
+    if (test.n == f.iv || test.n == iv.next) return false;
+    if (test.n && IsConstant(test.n, &value)) {
+      test.c = value;
+      test.n = NULL;
+    }
+    if (test.n) {
+      Load *length = dynamic_cast<Load*>(definition[test.n]);
+      if (!length || length->GetSrc(0) != f.base || length->GetOffset() != -4
+          || f.scale != 4 || !blockOf[test.n]->Dominates(f.preheader))
+        return false;
+    } else if (!IsSmall(f.scale * test.c))
+      return false;
+    test.pointer = (x == f.iv) ? f.pointer : f.pointerNext;
+    replaced.push_back(test);
+  }
+
+  for (int t = 0; t < tests.size(); t++) {
+    Test &test = replaced[t];
+    Location *bound = AddScaled(f.preheader, f.base, f.scale, test.n,
+                                f.scale * test.c + f.offset, f.pointer);
+    std::vector<Instruction*> &code = tests[t].first->code;
+    IfCmp *cmp = dynamic_cast<IfCmp*>(code[tests[t].second]);
+    code[tests[t].second] = new IfCmp(test.rel, test.pointer, bound, cmp->branch_label());
+  }
+  return true;
+}
+
+void InductionVariables::Run()
+{
+  FindDefinitions();
+  for (int l = 0; l < graph->loops.size(); l++) {
+    BasicBlock *preheader = PreheaderOf(graph->loops[l]);
+    if (preheader) FindBasicIVs(graph->loops[l], preheader);
+  }
+  for (int l = 0; l < graph->loops.size(); l++) {
+    BasicBlock *preheader = PreheaderOf(graph->loops[l]);
+    if (preheader) Reduce(graph->loops[l], preheader);
+  }
+  if (families.empty()) return;
+
+  // the addresses replaced are dead, and with them what they read of i
+  EliminateDeadCode(graph);
+  FindDefinitions();
+  std::set<Location*> done;
+  for (int f = 0; f < families.size(); f++)
+    if (!done.count(families[f].iv) && ReplaceTests(families[f]))
+      done.insert(families[f].iv);
+}
+
+void ReduceInductionVariables(FlowGraph *graph, SSA *ssa)
+{
+  InductionVariables pass(graph, ssa);
+  pass.Run();
+}
@@ -0,0 +1,230 @@
+/* File: inline.cc
+ * ---------------
+ * Inlining of calls to small functions, on the Tac of the whole
+ * program before it is split into flow graphs.
+ *
+ * A call is an LCall right after the PushParams of its arguments (the
+ * first argument pushed last) and followed by the PopParams taking
+ * them off. When the function called is small enough, the three are
+ * replaced by a copy of its body. The body's parameters, locals and
+ * temps become new variables of the caller: each parameter is first
+ * assigned the argument for it, which copy propagation usually undoes.
+ * A Return assigns its value to the variable the call result went in
+ * and jumps to the end of the copy, and the labels of the body are
+ * renamed so that every copy has its own.
+ *
+ * A method is a function taking "this" as its first parameter, so a
+ * call to one whose target is known (an LCall rather than an ACall) is
+ * inlined in the same way. The functions are visited in program order
+ * and a body is copied as it is at that point, calls inlined into it
+ * included, which stays bounded since only small bodies are copied.
+ * A function calling itself is never copied into itself.
+ */
+
+#include "optimize.h"
+#include "codegen.h"
+#include <cstring>
+#include <string>
+
+
+class Inliner
+{
+  public:
+    Inliner(std::list<Instruction*> &code);
+    void Run();
+
+  private:
+    struct Function {
+      const char *label;
+      std::list<Instruction*>::iterator begin;  // BeginFunc in code
+      std::vector<Instruction*> body;           // BeginFunc to EndFunc
+    };
+
+    std::list<Instruction*> &code;
+    std::vector<Function> functions;
+    std::map<std::string, int> byLabel;
+    int copies;                                  // bodies copied so far
+
+    static int Size(const std::vector<Instruction*> &body);
+    static Instruction *Copy(Instruction *instr);
+    Location *NewVariable(BeginFunc *begin, const char *name);
+    void InlineCall(std::vector<Instruction*> &out, BeginFunc *begin, LCall *call,
+                    const std::vector<Location*> &args, const Function &callee);
+    void InlineInto(Function &fn);
+};
+
+         // Bodies of at most this many instructions are copied, about
+         // what a call with a few arguments and its prologue and
+         // epilogue cost by themselves.
+static const int InlineLimit = 16;
+
+Inliner::Inliner(std::list<Instruction*> &c) : code(c), copies(0) {}
+
+// The instructions doing some work, without the function's BeginFunc
+// and EndFunc or the labels.
+int Inliner::Size(const std::vector<Instruction*> &body)
+{
+  int size = 0;
+  for (int i = 1; i + 1 < body.size(); i++)
+    if (!dynamic_cast<Label*>(body[i])) size++;
+  return size;
+}
+
+// A copy of instr with the same operands, for the kinds that can appear
+// in a body other than labels, returns and the function's start and end.
+Instruction *Inliner::Copy(Instruction *instr)
+{
+  if (LoadConstant *i = dynamic_cast<LoadConstant*>(instr)) return new LoadConstant(*i);
+  if (LoadStringConstant *i = dynamic_cast<LoadStringConstant*>(instr))
+    return new LoadStringConstant(*i);
+  if (LoadLabel *i = dynamic_cast<LoadLabel*>(instr)) return new LoadLabel(*i);
+  if (Assign *i = dynamic_cast<Assign*>(instr)) return new Assign(*i);
+  if (Load *i = dynamic_cast<Load*>(instr)) return new Load(*i);
+  if (Store *i = dynamic_cast<Store*>(instr)) return new Store(*i);
+  if (BinaryOp *i = dynamic_cast<BinaryOp*>(instr)) return new BinaryOp(*i);
+  if (Goto *i = dynamic_cast<Goto*>(instr)) return new Goto(*i);
+  if (IfZ *i = dynamic_cast<IfZ*>(instr)) return new IfZ(*i);
+  if (IfCmp *i = dynamic_cast<IfCmp*>(instr)) return new IfCmp(*i);
+  if (BoundsCheck *i = dynamic_cast<BoundsCheck*>(instr)) return new BoundsCheck(*i);
+  if (SizeCheck *i = dynamic_cast<SizeCheck*>(instr)) return new SizeCheck(*i);
+  if (PushParam *i = dynamic_cast<PushParam*>(instr)) return new PushParam(*i);
+  if (PopParams *i = dynamic_cast<PopParams*>(instr)) return new PopParams(*i);
+  if (LCall *i = dynamic_cast<LCall*>(instr)) return new LCall(*i);
+  if (ACall *i = dynamic_cast<ACall*>(instr)) return new ACall(*i);
+  Failure("Unexpected Tac instruction in a function body to inline");
+  return NULL;
+}
+
+// A new local of the function starting at begin, in a slot below its
+// other locals and temps.
+Location *Inliner::NewVariable(BeginFunc *begin, const char *name)
+{
+  char *unique = new char[strlen(name) + 12];
+  sprintf(unique, "%s_%d", name, copies);
+  int frameSize = begin->GetFrameSize();
+  begin->SetFrameSize(frameSize + CodeGenerator::VarSize);
+  return new Location(fpRelative, CodeGenerator::OffsetToFirstLocal - frameSize, unique);
+}
+
+/* Method: InlineCall
+ * ------------------
+ * Appends to out a copy of the callee's body standing for the call,
+ * its arguments given by args (the first one first).
+ */
+void Inliner::InlineCall(std::vector<Instruction*> &out, BeginFunc *begin, LCall *call,
+                         const std::vector<Location*> &args, const Function &callee)
+{
+  copies++;
+  const std::vector<Instruction*> &body = callee.body;
+  std::map<Location*, Location*> vars;
+  std::map<std::string, const char*> labels;
+
+  // the parameters are the variables at positive offsets, the n'th at 4n
+  for (int i = 1; i + 1 < body.size(); i++)
+    for (int s = -1; s < body[i]->NumSrcs(); s++) {
+      Location *var = s < 0 ? body[i]->GetDst() : body[i]->GetSrc(s);
+      if (!var || var->GetSegment() != fpRelative || vars.count(var)) continue;
+      if (var->GetOffset() < 0) {
+        vars[var] = NewVariable(begin, var->GetName());
+        continue;
+      }
+      int n = var->GetOffset() / CodeGenerator::VarSize;
+      Assert(n >= 1 && n <= args.size());
+      vars[var] = NewVariable(begin, var->GetName());
+      out.push_back(new Assign(vars[var], args[n - 1]));
+    }
+
+  const char *end = NULL;
+  for (int i = 1; i + 1 < body.size(); i++) {
+    Instruction *instr = body[i];
+    if (Label *label = dynamic_cast<Label*>(instr)) {
+      if (!labels.count(label->text())) labels[label->text()] = CodeGenerator::NewLabel();
+      out.push_back(new Label(labels[label->text()]));
+      continue;
+    }
+    if (Return *ret = dynamic_cast<Return*>(instr)) {
+      if (call->GetDst() && ret->NumSrcs() > 0)
+        out.push_back(new Assign(call->GetDst(), vars.count(ret->GetSrc(0))
+                                 ? vars[ret->GetSrc(0)] : ret->GetSrc(0)));
+      if (i + 2 < body.size()) {              // else it falls to the end
+        if (!end) end = CodeGenerator::NewLabel();
+        out.push_back(new Goto(end));
+      }
+      continue;
+    }
+    Instruction *copy = Copy(instr);
+    if (copy->GetDst() && vars.count(copy->GetDst()))
+      copy->SetDst(vars[copy->GetDst()]);
+    for (int s = 0; s < copy->NumSrcs(); s++)
+      if (vars.count(copy->GetSrc(s)))
+        copy->SetSrc(s, vars[copy->GetSrc(s)]);
+    if (const char *target = FlowGraph::BranchTarget(copy)) {
+      if (!labels.count(target)) labels[target] = CodeGenerator::NewLabel();
+      FlowGraph::SetBranchTarget(copy, labels[target]);
+    }
+    out.push_back(copy);
+  }
+  if (end) out.push_back(new Label(end));
+}
+
+void Inliner::InlineInto(Function &fn)
+{
+  std::vector<Instruction*> out;
+  BeginFunc *begin = dynamic_cast<BeginFunc*>(fn.body[0]);
+  for (int i = 0; i < fn.body.size(); i++) {
+    LCall *call = dynamic_cast<LCall*>(fn.body[i]);
+    std::map<std::string, int>::iterator callee;
+    if (!call || call->IsBuiltIn()
+        || (callee = byLabel.find(call->GetLabel())) == byLabel.end()
+        || &functions[callee->second] == &fn
+        || Size(functions[callee->second].body) > InlineLimit) {
+      out.push_back(fn.body[i]);
+      continue;
+    }
+    PopParams *pop = (i + 1 < fn.body.size()) ? dynamic_cast<PopParams*>(fn.body[i + 1]) : NULL;
+    int n = pop ? pop->GetBytes() / CodeGenerator::VarSize : 0;
+    std::vector<Location*> args;
+    for (int a = 0; a < n; a++) {               // the first argument was pushed last
+      PushParam *push = dynamic_cast<PushParam*>(out.back());
+      Assert(push != NULL);
+      args.push_back(push->GetSrc(0));
+      out.pop_back();
+    }
+    InlineCall(out, begin, call, args, functions[callee->second]);
+    if (pop) i++;
+  }
+  fn.body = out;
+}
+
+void Inliner::Run()
+{
+  std::list<Instruction*>::iterator p, prev = code.end();
+  for (p = code.begin(); p != code.end(); prev = p++) {
+    if (!dynamic_cast<BeginFunc*>(*p)) continue;
+    Label *label = (prev != code.end()) ? dynamic_cast<Label*>(*prev) : NULL;
+    Assert(label != NULL);
+    Function fn;
+    fn.label = label->text();
+    fn.begin = p;
+    std::list<Instruction*>::iterator q = p;
+    do {
+      fn.body.push_back(*q);
+    } while (!dynamic_cast<EndFunc*>(*q++));
+    byLabel[fn.label] = functions.size();
+    functions.push_back(fn);
+  }
+
+  for (int f = 0; f < functions.size(); f++) {
+    InlineInto(functions[f]);
+    std::list<Instruction*>::iterator end = functions[f].begin;
+    while (!dynamic_cast<EndFunc*>(*end++)) ;
+    p = code.erase(functions[f].begin, end);
+    code.insert(p, functions[f].body.begin(), functions[f].body.end());
+  }
+}
+
+void InlineCalls(std::list<Instruction*> &code)
+{
+  Inliner pass(code);
+  pass.Run();
+}
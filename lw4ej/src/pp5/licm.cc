@@ -0,0 +1,414 @@
+/* File: licm.cc
+ * -------------
+ * Loop-invariant code motion on SSA form.
+ *
+ * Each loop first gets a preheader: a block that the loop is entered
+ * from and that goes nowhere else, made if the header has more than one
+ * predecessor outside the loop or that one has other successors. Then,
+ * innermost loops first so what leaves an inner loop can go on to leave
+ * the outer one, the instructions of the loop whose operands are all
+ * set outside it are moved to the preheader, repeatedly as moving one
+ * can make others invariant.
+ *
+ * A moved instruction runs once each time the loop is entered, even if
+ * the iteration that ran it before wouldn't have, so only instructions
+ * that can't go wrong are moved freely. A Load (which faults on null),
+ * an Add or Sub (which trap on overflow) or a Div or Mod (which stop on
+ * zero) is only moved if its block is sure to run once the loop is
+ * entered, or if the Load is from "this", which every call of a method
+ * has checked isn't null (see CodeGenerator::GenNullCheck).
+ * A bounds or size check that may stop the program counts as a way out
+ * of the loop, so nothing that can go wrong is moved from after one,
+ * nor from after a call (a Print's output included) earlier in the
+ * body, which would then not run before the program stopped.
+ * A Load also has to read a word nothing in the loop may change.
+ *
+ * What is moved out has to stay in a register through the whole loop.
+ * A constant is only moved along with an instruction using it, since
+ * loading one again costs no more than a copy, and arithmetic is left
+ * alone in loops making calls, where registers kept across a call are
+ * few and it would only take one a Load could have used.
+ */
+
+#include "optimize.h"
+#include "codegen.h"
+#include <algorithm>
+#include <cstring>
+#include <set>
+
+
+class LoopInvariantMotion
+{
+  public:
+    LoopInvariantMotion(FlowGraph *graph, SSA *ssa);
+    void Run();
+
+  private:
+    FlowGraph *graph;
+    SSA *ssa;
+    std::map<Location*, Instruction*> definition;
+
+    BasicBlock *MakePreheader(BasicBlock *header);
+    void MoveToPreheader(Instruction *instr, BasicBlock *preheader);
+    bool ConstantOnEntry(Location *var, BasicBlock *preheader, int *value);
+    bool RunsAtLeastOnce(Loop *loop, BasicBlock *preheader);
+    bool IsSafeAnywhere(Instruction *instr);
+    void HoistGlobals(Loop *loop, BasicBlock *preheader);
+    void Hoist(Loop *loop, BasicBlock *preheader, MemoryModel &memory);
+};
+
+LoopInvariantMotion::LoopInvariantMotion(FlowGraph *g, SSA *s) : graph(g), ssa(s) {}
+
+static int PhiPosition(BasicBlock *b)
+{
+  return b->GetLabel() ? 1 : 0;
+}
+
+/* Method: MakePreheader
+ * ---------------------
+ * A new preheader goes right before the header in the layout, so the
+ * block falling through to the header from outside the loop now falls
+ * through to it, and the branches to the header from outside the loop
+ * are sent to it. If the block falling through to the header is in
+ * the loop, a block with just a Goto to the header is put in between,
+ * and the header's phis take from it what that block gave them. The
+ * header's phis then get one argument from the preheader instead of
+ * those from outside the loop, merged by a phi in the preheader if
+ * they differ.
+ */
+BasicBlock *LoopInvariantMotion::MakePreheader(BasicBlock *header)
+{
+  Loop *loop = header->loop;
+  std::vector<BasicBlock*> outside;
+  for (int p = 0; p < header->preds.size(); p++)
+    if (!loop->Contains(header->preds[p]))
+      outside.push_back(header->preds[p]);
+  if (outside.size() == 1 && outside[0]->succs.size() == 1)
+    return outside[0];
+
+  const char *headerLabel = header->GetLabel();
+  Assert(headerLabel != NULL);
+  std::vector<std::vector<std::pair<BasicBlock*, Location*> > > entering;
+  for (int i = PhiPosition(header); i < header->code.size(); i++) {
+    Phi *phi = dynamic_cast<Phi*>(header->code[i]);
+    if (!phi) break;
+    entering.push_back(std::vector<std::pair<BasicBlock*, Location*> >());
+    for (int p = 0; p < header->preds.size(); p++)
+      if (!loop->Contains(header->preds[p]))
+        entering.back().push_back(std::make_pair(header->preds[p], phi->GetSrc(p)));
+  }
+
+  const char *label = CodeGenerator::NewLabel();
+  BasicBlock *preheader = new BasicBlock(0);
+  preheader->code.push_back(new Label(label));
+  for (int p = 0; p < outside.size(); p++) {
+    const char *target = FlowGraph::BranchTarget(outside[p]->Last());
+    if (target && !strcmp(target, headerLabel))
+      FlowGraph::SetBranchTarget(outside[p]->Last(), label);
+  }
+  std::vector<BasicBlock*> &blocks = graph->blocks;
+  int at = header->id;
+  blocks.insert(blocks.begin() + at, preheader);
+  Instruction *last = (at > 0) ? blocks[at - 1]->Last() : NULL;
+  BasicBlock *jump = NULL;
+  std::vector<Location*> fromJump;
+  if (at > 0 && loop->Contains(blocks[at - 1]) && !dynamic_cast<Goto*>(last)
+      && !dynamic_cast<Return*>(last) && !FlowGraph::IsHalt(last)) {
+    int p = std::find(header->preds.begin(), header->preds.end(), blocks[at - 1])
+            - header->preds.begin();
+    for (int i = PhiPosition(header); i < header->code.size(); i++)
+      if (Phi *phi = dynamic_cast<Phi*>(header->code[i]))
+        fromJump.push_back(phi->GetSrc(p));
+    jump = new BasicBlock(0);
+    jump->code.push_back(new Goto(headerLabel));
+    blocks.insert(blocks.begin() + at, jump);
+  }
+  graph->Renumber();
+
+  if (jump) {    // the header's phis take what the block falling through gave
+    int p = std::find(header->preds.begin(), header->preds.end(), jump)
+            - header->preds.begin();
+    for (int i = 0; i < fromJump.size(); i++)
+      header->code[PhiPosition(header) + i]->SetSrc(p, fromJump[i]);
+  }
+
+  int fromPreheader = std::find(header->preds.begin(), header->preds.end(), preheader)
+                      - header->preds.begin();
+  for (int i = 0; i < entering.size(); i++) {
+    Phi *phi = dynamic_cast<Phi*>(header->code[PhiPosition(header) + i]);
+    Location *value = entering[i][0].second;
+    for (int e = 1; e < entering[i].size(); e++)
+      if (entering[i][e].second != value) value = NULL;
+    if (!value) {
+      value = ssa->NewVersion(phi->GetDst());
+      Phi *merge = new Phi(value, preheader->preds.size());
+      for (int p = 0; p < preheader->preds.size(); p++)
+        for (int e = 0; e < entering[i].size(); e++)
+          if (entering[i][e].first == preheader->preds[p])
+            merge->SetSrc(p, entering[i][e].second);
+      preheader->code.insert(preheader->code.begin() + PhiPosition(preheader), merge);
+      definition[value] = merge;
+    }
+    phi->SetSrc(fromPreheader, value);
+  }
+  return preheader;
+}
+
+void LoopInvariantMotion::MoveToPreheader(Instruction *instr, BasicBlock *preheader)
+{
+  std::vector<Instruction*> &code = preheader->code;
+  int pos = (!code.empty() && FlowGraph::EndsBlock(code.back()))
+            ? code.size() - 1 : code.size();
+  code.insert(code.begin() + pos, instr);
+}
+
+// The value var has the first time through the header, if known.
+bool LoopInvariantMotion::ConstantOnEntry(Location *var, BasicBlock *preheader, int *value)
+{
+  Instruction *def = definition.count(var) ? definition[var] : NULL;
+  BasicBlock *header = preheader->succs[0];
+  if (Phi *phi = dynamic_cast<Phi*>(def)) {
+    int p = std::find(header->preds.begin(), header->preds.end(), preheader)
+            - header->preds.begin();
+    var = phi->GetSrc(p);
+    def = definition.count(var) ? definition[var] : NULL;
+  }
+  LoadConstant *lc = dynamic_cast<LoadConstant*>(def);
+  if (lc) *value = lc->GetValue();
+  return lc != NULL;
+}
+
+// True if the header's test is known to stay in the loop the first
+// time, as in "for (i = 0; i < 10; ...)".
+bool LoopInvariantMotion::RunsAtLeastOnce(Loop *loop, BasicBlock *preheader)
+{
+  BasicBlock *header = loop->header;
+  Instruction *test = header->Last();
+  int a, b;
+  bool taken;
+  if (dynamic_cast<IfZ*>(test)) {
+    if (!ConstantOnEntry(test->GetSrc(0), preheader, &a)) return false;
+    taken = (a == 0);
+  } else if (IfCmp *cmp = dynamic_cast<IfCmp*>(test)) {
+    if (!ConstantOnEntry(cmp->GetSrc(0), preheader, &a)) return false;
+    if (cmp->HasImmediate())
+      b = cmp->GetImmediate();
+    else if (!ConstantOnEntry(cmp->GetSrc(1), preheader, &b))
+      return false;
+    taken = IfCmp::Holds(cmp->GetRelation(), a, b);
+  } else
+    return false;
+
+  std::vector<BasicBlock*> &blocks = graph->blocks;
+  BasicBlock *next = NULL;
+  if (!taken && header->id + 1 < blocks.size())
+    next = blocks[header->id + 1];
+  for (int s = 0; taken && s < header->succs.size(); s++)
+    if (header->succs[s]->GetLabel()
+        && !strcmp(header->succs[s]->GetLabel(), FlowGraph::BranchTarget(test)))
+      next = header->succs[s];
+  return next && loop->Contains(next);
+}
+
+// Instructions with no effect but setting their destination that can't
+// fault or stop the program.
+bool LoopInvariantMotion::IsSafeAnywhere(Instruction *instr)
+{
+  if (BinaryOp *op = dynamic_cast<BinaryOp*>(instr)) {
+    BinaryOp::OpCode code = op->GetOpCode();
+    return code != BinaryOp::Div && code != BinaryOp::Mod
+      && code != BinaryOp::Add && code != BinaryOp::Sub;
+  }
+  if (Load *load = dynamic_cast<Load*>(instr))
+    return load->GetSrc(0) == CodeGenerator::ThisPtr;
+  return dynamic_cast<Assign*>(instr) || dynamic_cast<LoadStringConstant*>(instr)
+    || dynamic_cast<LoadLabel*>(instr);
+}
+
+/* Method: HoistGlobals
+ * --------------------
+ * A global is read from memory each time it is used. If the loop never
+ * assigns it and makes no call (which might), it is read once into a
+ * new variable in the preheader and the loop uses that instead.
+ */
+void LoopInvariantMotion::HoistGlobals(Loop *loop, BasicBlock *preheader)
+{
+  std::set<Location*> read, written;
+  for (int b = 0; b < loop->blocks.size(); b++) {
+    std::vector<Instruction*> &code = loop->blocks[b]->code;
+    for (int i = 0; i < code.size(); i++) {
+      if (MemoryModel::ChangesMemory(code[i]) && !dynamic_cast<Store*>(code[i]))
+        return;
+      if (code[i]->GetDst() && code[i]->GetDst()->GetSegment() == gpRelative)
+        written.insert(code[i]->GetDst());
+      for (int s = 0; s < code[i]->NumSrcs(); s++)
+        if (code[i]->GetSrc(s)->GetSegment() == gpRelative)
+          read.insert(code[i]->GetSrc(s));
+    }
+  }
+
+  std::map<Location*, Location*> copy;
+  for (std::set<Location*>::iterator g = read.begin(); g != read.end(); ++g)
+    if (!written.count(*g)) {
+      copy[*g] = ssa->NewVersion(*g);
+      Instruction *load = new Assign(copy[*g], *g);
+      definition[copy[*g]] = load;
+      MoveToPreheader(load, preheader);
+    }
+  if (copy.empty()) return;
+  for (int b = 0; b < loop->blocks.size(); b++) {
+    std::vector<Instruction*> &code = loop->blocks[b]->code;
+    for (int i = 0; i < code.size(); i++)
+      for (int s = 0; s < code[i]->NumSrcs(); s++)
+        if (copy.count(code[i]->GetSrc(s)))
+          code[i]->SetSrc(s, copy[code[i]->GetSrc(s)]);
+  }
+}
+
+// Whether any of the first n instructions is a check that may stop the
+// program, which the loop then leaves from.
+static bool ChecksAt(const std::vector<Instruction*> &code, int n)
+{
+  for (int i = 0; i < n; i++)
+    if (dynamic_cast<BoundsCheck*>(code[i]) || dynamic_cast<SizeCheck*>(code[i]))
+      return true;
+  return false;
+}
+
+// Whether any of the first n instructions is a call, built-ins and
+// their output included, which has to run before what may stop the
+// program after it.
+static bool CallsAt(const std::vector<Instruction*> &code, int n)
+{
+  for (int i = 0; i < n; i++)
+    if (dynamic_cast<LCall*>(code[i]) || dynamic_cast<ACall*>(code[i]))
+      return true;
+  return false;
+}
+
+static bool EarlierInOrder(BasicBlock *a, BasicBlock *b)
+{
+  return a->rpo < b->rpo;
+}
+
+void LoopInvariantMotion::Hoist(Loop *loop, BasicBlock *preheader, MemoryModel &memory)
+{
+  std::vector<BasicBlock*> body(loop->blocks);
+  std::sort(body.begin(), body.end(), EarlierInOrder);
+  std::set<Location*> setInLoop;
+  std::map<Location*, BasicBlock*> constants;   // LoadConstants in the loop
+  std::vector<Instruction*> clobbers;
+  std::vector<BasicBlock*> exits;
+  bool calls = false, stops = false;       // stops: header may stop program
+  std::vector<bool> callsBefore(body.size(), false);  // in a block earlier in order
+  for (int b = 0; b < body.size(); b++) {
+    if (b > 0) {
+      std::vector<Instruction*> &prev = body[b - 1]->code;
+      callsBefore[b] = callsBefore[b - 1] || CallsAt(prev, prev.size());
+    }
+    for (int i = 0; i < body[b]->code.size(); i++) {
+      Instruction *instr = body[b]->code[i];
+      if (SSA::IsRenamed(instr->GetDst())) setInLoop.insert(instr->GetDst());
+      if (dynamic_cast<LoadConstant*>(instr)) constants[instr->GetDst()] = body[b];
+      if (MemoryModel::ChangesMemory(instr)) clobbers.push_back(instr);
+      if (MemoryModel::ChangesMemory(instr) && !dynamic_cast<Store*>(instr)) calls = true;
+    }
+    std::vector<Instruction*> &code = body[b]->code;
+    bool leaves = FlowGraph::IsHalt(body[b]->Last()) || ChecksAt(code, code.size());
+    if (leaves && body[b] == loop->header) stops = true;
+    for (int s = 0; s < body[b]->succs.size() && !leaves; s++)
+      leaves = !loop->Contains(body[b]->succs[s]);
+    if (leaves) exits.push_back(body[b]);
+  }
+
+  // the blocks run whenever the loop is entered: those on the way to
+  // every exit, and if the first test is known to stay in the loop,
+  // those on the way to every other exit and to the back edges
+  bool once = !stops && RunsAtLeastOnce(loop, preheader);
+  std::vector<BasicBlock*> mustReach;
+  for (int e = 0; e < exits.size(); e++)
+    if (!once || exits[e] != loop->header) mustReach.push_back(exits[e]);
+  if (once)
+    mustReach.insert(mustReach.end(), loop->latches.begin(), loop->latches.end());
+  std::set<BasicBlock*> alwaysRun;
+  for (int b = 0; b < body.size(); b++) {
+    bool runs = true;
+    for (int m = 0; m < mustReach.size() && runs; m++)
+      runs = body[b]->Dominates(mustReach[m]);
+    if (runs) alwaysRun.insert(body[b]);
+  }
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int b = 0; b < body.size(); b++) {
+      std::vector<Instruction*> &code = body[b]->code;
+      for (int i = 0; i < code.size(); i++) {
+        Instruction *instr = code[i];
+        if (!SSA::IsRenamed(instr->GetDst()) || dynamic_cast<Phi*>(instr)
+            || dynamic_cast<LCall*>(instr) || dynamic_cast<ACall*>(instr))
+          continue;
+        if (dynamic_cast<LoadConstant*>(instr) || (calls && dynamic_cast<BinaryOp*>(instr)))
+          continue;                         // cheaper to redo than to keep
+        bool invariant = true;
+        for (int s = 0; s < instr->NumSrcs() && invariant; s++) {
+          Location *src = instr->GetSrc(s);
+          invariant = SSA::IsRenamed(src) && (!setInLoop.count(src) || constants.count(src));
+        }
+        if (!invariant || (!IsSafeAnywhere(instr)
+                           && (!alwaysRun.count(body[b]) || ChecksAt(code, i)
+                               || callsBefore[b] || CallsAt(code, i))))
+          continue;
+        if (Load *load = dynamic_cast<Load*>(instr)) {
+          bool changes = false;
+          for (int c = 0; c < clobbers.size() && !changes; c++)
+            changes = memory.MayChange(clobbers[c], load->GetSrc(0), load->GetOffset());
+          if (changes) continue;
+        }
+        for (int s = 0; s < instr->NumSrcs(); s++) {
+          Location *src = instr->GetSrc(s);
+          if (!constants.count(src)) continue;
+          std::vector<Instruction*> &from = constants[src]->code;
+          int at = std::find(from.begin(), from.end(), definition[src]) - from.begin();
+          if (constants[src] == body[b] && at < i) i--;
+          MoveToPreheader(from[at], preheader);
+          from.erase(from.begin() + at);
+          constants.erase(src);
+          setInLoop.erase(src);
+        }
+        code.erase(code.begin() + i--);
+        MoveToPreheader(instr, preheader);
+        setInLoop.erase(instr->GetDst());
+        changed = true;
+      }
+    }
+  }
+}
+
+void LoopInvariantMotion::Run()
+{
+  if (graph->loops.empty()) return;
+  std::vector<BasicBlock*> headers, preheaders;
+  for (int i = graph->loops.size() - 1; i >= 0; i--)     // inner loops first
+    headers.push_back(graph->loops[i]->header);
+  for (int h = 0; h < headers.size(); h++)
+    preheaders.push_back(MakePreheader(headers[h]));
+
+  for (int b = 0; b < graph->blocks.size(); b++) {
+    std::vector<Instruction*> &code = graph->blocks[b]->code;
+    for (int i = 0; i < code.size(); i++)
+      if (SSA::IsRenamed(code[i]->GetDst()))
+        definition[code[i]->GetDst()] = code[i];
+  }
+  MemoryModel memory(graph);
+  for (int h = 0; h < headers.size(); h++) {
+    HoistGlobals(headers[h]->loop, preheaders[h]);
+    Hoist(headers[h]->loop, preheaders[h], memory);
+  }
+}
+
+void HoistLoopInvariants(FlowGraph *graph, SSA *ssa)
+{
+  LoopInvariantMotion pass(graph, ssa);
+  pass.Run();
+}
@@ -0,0 +1,103 @@
+/* File: memory.cc
+ * ---------------
+ * Implementation of the MemoryModel class.
+ *
+ * The Tac gives no types, but the way it addresses memory still tells
+ * a lot. An object's fields are read and written at the address of the
+ * object plus a constant offset, while array elements are reached
+ * through an address computed from the array's base (an array's length
+ * is at offset -4 from its base). A variable holding such a computed
+ * address is set by a BinaryOp; any other pointer points to the start
+ * of an object or array (or is null). So a field can only be changed
+ * by a store to the same offset from some object start, and an element
+ * only by a store through a computed address. A variable set by phis
+ * and copies from both kinds may be either, and may alias anything.
+ *
+ * Some words are never changed once set up: an object's vtable pointer
+ * (at offset 0, set right after allocating the object), the vtables
+ * themselves and the length of an array. Only a store to the same
+ * offset from an object start, which doesn't happen after the object
+ * or array is created, is taken to change them; calls don't.
+ */
+
+#include "optimize.h"
+
+
+MemoryModel::MemoryModel(FlowGraph *graph)
+{
+  std::vector<Instruction*> copies;       // phis and Assigns
+  for (int b = 0; b < graph->blocks.size(); b++) {
+    std::vector<Instruction*> &code = graph->blocks[b]->code;
+    for (int i = 0; i < code.size(); i++) {
+      Location *dst = code[i]->GetDst();
+      if (!SSA::IsRenamed(dst)) continue;
+      definition[dst] = code[i];
+      if (dynamic_cast<Phi*>(code[i]) || dynamic_cast<Assign*>(code[i])) {
+        kinds[dst] = None;
+        copies.push_back(code[i]);
+      } else
+        kinds[dst] = dynamic_cast<BinaryOp*>(code[i]) ? Computed : Start;
+    }
+  }
+
+  // a copy has the kind of its sources, found by iterating from None
+  // (no source seen yet) as the sources of a phi may come after it
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int i = 0; i < copies.size(); i++) {
+      AddressKind kind = None;
+      for (int s = 0; s < copies[i]->NumSrcs(); s++) {
+        std::map<Location*, AddressKind>::iterator it = kinds.find(copies[i]->GetSrc(s));
+        AddressKind k = (it == kinds.end()) ? Start : it->second;
+        if (kind == None) kind = k;
+        else if (k != None && k != kind) kind = Unknown;
+      }
+      if (kind != kinds[copies[i]->GetDst()]) {
+        kinds[copies[i]->GetDst()] = kind;
+        changed = true;
+      }
+    }
+  }
+}
+
+// Variables not set in the function (parameters and globals) hold
+// object starts, as do phis never given anything else.
+MemoryModel::AddressKind MemoryModel::KindOf(Location *var)
+{
+  std::map<Location*, AddressKind>::iterator it = kinds.find(var);
+  return (it == kinds.end() || it->second == None) ? Start : it->second;
+}
+
+bool MemoryModel::IsVTable(Location *var)
+{
+  std::map<Location*, Instruction*>::iterator def = definition.find(var);
+  if (def == definition.end()) return false;
+  if (dynamic_cast<LoadLabel*>(def->second)) return true;
+  Load *load = dynamic_cast<Load*>(def->second);
+  return load && load->GetOffset() == 0 && KindOf(load->GetSrc(0)) == Start;
+}
+
+bool MemoryModel::CantChange(Location *base, int offset)
+{
+  return offset < 0 || (offset == 0 && KindOf(base) == Start) || IsVTable(base);
+}
+
+bool MemoryModel::ChangesMemory(Instruction *instr)
+{
+  if (LCall *call = dynamic_cast<LCall*>(instr))
+    return !call->IsBuiltIn();            // built-ins only touch new memory
+  return dynamic_cast<Store*>(instr) || dynamic_cast<ACall*>(instr);
+}
+
+bool MemoryModel::MayChange(Instruction *clobber, Location *base, int offset)
+{
+  Store *store = dynamic_cast<Store*>(clobber);
+  if (!store) return ChangesMemory(clobber) && !CantChange(base, offset);
+  AddressKind to = KindOf(store->GetSrc(0)), from = KindOf(base);
+  if (CantChange(base, offset))
+    return store->GetOffset() == offset && to != Computed;
+  if (to == Unknown || from == Unknown) return true;
+  if (to != from) return false;
+  return to == Computed || store->GetOffset() == offset;
+}
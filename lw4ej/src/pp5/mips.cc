@@ -21,8 +21,12 @@
  */
 
 #include "mips.h"
+#include "regalloc.h"
+#include "codegen.h"
+#include "errors.h"
 #include <stdarg.h>
 #include <cstring>
+#include <algorithm>
 
 
 
@@ -38,6 +42,23 @@ static bool LocationsAreSame(Location *var1, Location *var2)
 }
 
 
+/* Method: FrameBase, FrameOffset
+ * -------------------------------
+ * The register stack variables are addressed off, and the offset from
+ * it of a variable at fpOffset from the frame pointer. Without a frame
+ * pointer, $sp stays put frameBytes below where $fp would have been.
+ */
+const char *Mips::FrameBase()
+{
+  return omitFramePointer ? regs[sp].name : regs[fp].name;
+}
+
+int Mips::FrameOffset(int fpOffset)
+{
+  return omitFramePointer ? fpOffset + frameBytes : fpOffset;
+}
+
+
 /* Method: SpillRegister
  * ---------------------
  * Used to spill a register from reg to dst.  All it does is emit a store
@@ -46,11 +67,12 @@ static bool LocationsAreSame(Location *var1, Location *var2)
 void Mips::SpillRegister(Location *dst, Register reg)
 {
   Assert(dst);
-  const char *offsetFromWhere = dst->GetSegment() == fpRelative? regs[fp].name : regs[gp].name;
+  const char *offsetFromWhere = dst->GetSegment() == fpRelative? FrameBase() : regs[gp].name;
+  int offset = dst->GetSegment() == fpRelative? FrameOffset(dst->GetOffset()) : dst->GetOffset();
   Assert(dst->GetOffset() % 4 == 0); // all variables are 4 bytes in size
   Emit("sw %s, %d(%s)\t# spill %s from %s to %s%+d", regs[reg].name,
-       dst->GetOffset(), offsetFromWhere, dst->GetName(), regs[reg].name,
-       offsetFromWhere,dst->GetOffset());
+       offset, offsetFromWhere, dst->GetName(), regs[reg].name,
+       offsetFromWhere, offset);
 }
 
 /* Method: FillRegister
@@ -61,11 +83,241 @@ void Mips::SpillRegister(Location *dst, Register reg)
 void Mips::FillRegister(Location *src, Register reg)
 {
   Assert(src);
-  const char *offsetFromWhere = src->GetSegment() == fpRelative? regs[fp].name : regs[gp].name;
+  const char *offsetFromWhere = src->GetSegment() == fpRelative? FrameBase() : regs[gp].name;
+  int offset = src->GetSegment() == fpRelative? FrameOffset(src->GetOffset()) : src->GetOffset();
   Assert(src->GetOffset() % 4 == 0); // all variables are 4 bytes in size
   Emit("lw %s, %d(%s)\t# fill %s to %s from %s%+d", regs[reg].name,
-       src->GetOffset(), offsetFromWhere, src->GetName(), regs[reg].name,
-       offsetFromWhere,src->GetOffset());
+       offset, offsetFromWhere, src->GetName(), regs[reg].name,
+       offsetFromWhere, offset);
+}
+
+
+/* Method: HomeRegister
+ * --------------------
+ * Returns the register the allocator assigned to var for the whole
+ * of the current function, or zero if var lives in memory.
+ */
+Mips::Register Mips::HomeRegister(Location *var)
+{
+  std::map<Location*, Register>::iterator it = homeRegister.find(var);
+  return it == homeRegister.end() ? zero : it->second;
+}
+
+
+/* Method: FindRegisterWithContents
+ * ---------------------------------
+ * Searches the register cache for one currently holding var's value.
+ * Returns NumRegs if var is not slaved in any register.
+ */
+Mips::Register Mips::FindRegisterWithContents(Location *var)
+{
+  for (Register r = t0; r <= t9; r = (Register)(r + 1))
+    if (LocationsAreSame(var, regs[r].var))
+      return r;
+  return NumRegs;
+}
+
+
+/* Method: SelectRegisterToSpill
+ * -----------------------------
+ * Picks the cache register to hold a new variable: an empty one if
+ * there is one, otherwise the least recently used, never one already
+ * handed out for the current instruction. Only the caller-saved
+ * $t0-$t9 are used; the cache is emptied at every call anyway so the
+ * callee-saved registers would buy nothing but save/restore code.
+ */
+Mips::Register Mips::SelectRegisterToSpill()
+{
+  Register best = NumRegs;
+  for (Register r = t0; r <= t9; r = (Register)(r + 1)) {
+    if (regs[r].var == NULL)
+      return r;
+    if (regs[r].lastUse != instructionNum
+        && (best == NumRegs || regs[r].lastUse < regs[best].lastUse))
+      best = r;
+  }
+  Assert(best != NumRegs);
+  return best;
+}
+
+
+/* Method: GetRegister
+ * -------------------
+ * Returns the register holding var. If var was assigned a register
+ * that register is used directly. With the register cache, var is
+ * slaved into a cache register, reusing one that already holds it
+ * (when reading, it is filled from memory if not). Otherwise var is
+ * slaved into the scratch register given, filled if being read.
+ * After writing to a register obtained with ForWrite, call
+ * StoreResult so a value slaved in a register is written back.
+ * Writing var also means any other variable sharing its stack slot
+ * is dead, and must not be written back over it later.
+ */
+Mips::Register Mips::GetRegister(Location *var, Reason reason, Register scratch)
+{
+  Register reg = HomeRegister(var);
+  if (reg != zero)
+    return reg;
+  if (!cacheRegisters) {
+    if (reason == ForRead)
+      FillRegister(var, scratch);
+    return scratch;
+  }
+  if (reason == ForWrite)
+    DiscardSlotSharers(var);
+  if ((reg = FindRegisterWithContents(var)) == NumRegs) {
+    reg = SelectRegisterToSpill();
+    if (regs[reg].isDirty)
+      SpillRegister(regs[reg].var, reg);
+    if (reason == ForRead)
+      FillRegister(var, reg);
+    regs[reg].var = var;
+    regs[reg].isDirty = false;
+  }
+  regs[reg].lastUse = instructionNum;
+  return reg;
+}
+
+
+void Mips::DiscardSlotSharers(Location *var)
+{
+  for (Register r = t0; r <= t9; r = (Register)(r + 1)) {
+    Location *other = regs[r].var;
+    if (other && !LocationsAreSame(var, other)
+        && other->GetSegment() == var->GetSegment()
+        && other->GetOffset() == var->GetOffset()) {
+      regs[r].var = NULL;
+      regs[r].isDirty = false;
+    }
+  }
+}
+
+
+/* Method: StoreResult
+ * -------------------
+ * Commits a value just computed into reg for dst: nothing to do if
+ * reg is dst's own register, with the register cache it is marked
+ * dirty to be spilled later, otherwise it is spilled to dst's slot.
+ */
+void Mips::StoreResult(Location *dst, Register reg)
+{
+  if (HomeRegister(dst) == reg)
+    return;
+  if (cacheRegisters) {
+    Assert(LocationsAreSame(regs[reg].var, dst));
+    regs[reg].isDirty = true;
+  } else
+    SpillRegister(dst, reg);
+}
+
+
+/* Method: SpillAllDirtyRegisters
+ * ------------------------------
+ * Writes back every cache register whose value is newer than memory.
+ * Registers keep their contents, which stay valid as long as control
+ * doesn't leave the basic block.
+ */
+void Mips::SpillAllDirtyRegisters()
+{
+  for (Register r = t0; r <= t9; r = (Register)(r + 1))
+    if (regs[r].isDirty) {
+      SpillRegister(regs[r].var, r);
+      regs[r].isDirty = false;
+    }
+}
+
+
+/* Method: SpillForEndFunction
+ * ---------------------------
+ * On the way out of a function only globals need to be written back,
+ * the locals and temps die with the frame.
+ */
+void Mips::SpillForEndFunction()
+{
+  for (Register r = t0; r <= t9; r = (Register)(r + 1))
+    if (regs[r].isDirty && regs[r].var->GetSegment() == gpRelative) {
+      SpillRegister(regs[r].var, r);
+      regs[r].isDirty = false;
+    }
+}
+
+
+/* Method: DiscardAllRegisters
+ * ---------------------------
+ * Forgets the contents of the cache registers, used where a new basic
+ * block may be reached from elsewhere, or when a call is about to
+ * clobber them. Dirty values must have been spilled first.
+ */
+void Mips::DiscardAllRegisters()
+{
+  for (Register r = t0; r <= t9; r = (Register)(r + 1)) {
+    Assert(!regs[r].isDirty || regs[r].var->GetSegment() == fpRelative);
+    regs[r].var = NULL;
+    regs[r].isDirty = false;
+  }
+}
+
+
+/* Method: AllocateRegisters
+ * -------------------------
+ * Runs the linear scan allocator over a function about to be emitted
+ * (the Tac from BeginFunc to EndFunc) and records the outcome: the
+ * register assigned to each variable, the callee-saved registers the
+ * prologue must preserve, and the parameters whose incoming values the
+ * prologue has to move to their registers (or, for those arriving in
+ * $a0-$a3 but left in memory, to their stack slots). Also counts the
+ * most arguments passed by any call, to size the outgoing area, and
+ * notes whether the function is a leaf.
+ * $t8/$t9 and $v1 are kept out of the pools as scratch for the
+ * variables left in memory. Those locals and temps are then packed
+ * into as few stack slots as their live intervals allow. Without
+ * register allocation (at -O1) only the slots are assigned.
+ */
+void Mips::AllocateRegisters(const std::vector<Instruction*> &fn)
+{
+  static const int callerSaved[] = {t0, t1, t2, t3, t4, t5, t6, t7};
+  static const int calleeSaved[] = {s0, s1, s2, s3, s4, s5, s6, s7};
+  LinearScan scan(fn);
+  if (GetOptimizationLevel() > 1)
+    scan.Allocate(std::vector<int>(callerSaved, callerSaved + 8),
+                  std::vector<int>(calleeSaved, calleeSaved + 8));
+  localBytes = CodeGenerator::VarSize
+    * scan.AssignStackSlots(CodeGenerator::OffsetToFirstLocal);
+
+  homeRegister.clear();
+  savedRegisters.clear();
+  entryParams.clear();
+  outgoingArgs = 0;
+  isLeaf = true;
+
+  const LinearScan::Assignment &assigned = scan.GetAssignment();
+  LinearScan::Assignment::const_iterator it;
+  for (it = assigned.begin(); it != assigned.end(); ++it) {
+    Register reg = (Register)it->second;
+    homeRegister[it->first] = reg;
+    if (reg >= s0 && reg <= s7 && std::find(savedRegisters.begin(),
+             savedRegisters.end(), reg) == savedRegisters.end())
+      savedRegisters.push_back(reg);
+  }
+  std::sort(savedRegisters.begin(), savedRegisters.end());
+
+  int pushed = 0;
+  for (int i = 0; i < fn.size(); i++) {
+    for (int s = -1; s < fn[i]->NumSrcs(); s++) {
+      Location *var = s < 0 ? fn[i]->GetDst() : fn[i]->GetSrc(s);
+      if (s >= 0 && var->GetSegment() == fpRelative && var->GetOffset() > 0
+          && scan.IsLiveOnEntry(var) && std::find(entryParams.begin(),
+             entryParams.end(), var) == entryParams.end())
+        entryParams.push_back(var);
+    }
+    if (dynamic_cast<PushParam*>(fn[i]))
+      pushed++;
+    else if (dynamic_cast<LCall*>(fn[i]) || dynamic_cast<ACall*>(fn[i])) {
+      isLeaf = false;
+      outgoingArgs = std::max(outgoingArgs, pushed);
+      pushed = 0;
+    }
+  }
 }
 
 
@@ -99,10 +351,10 @@ void Mips::Emit(const char *fmt, ...)
  */
 void Mips::EmitLoadConstant(Location *dst, int val)
 {
-  Register r = rd; 
+  Register r = GetRegister(dst, ForWrite, rd);
   Emit("li %s, %d\t\t# load constant value %d into %s", regs[r].name,
 	 val, val, regs[r].name);
-  SpillRegister(dst, rd);
+  StoreResult(dst, r);
 }
 
 /* Method: EmitLoadStringConstant
@@ -113,14 +365,26 @@ void Mips::EmitLoadConstant(Location *dst, int val)
  * and loads that label address into the register.
  */
 void Mips::EmitLoadStringConstant(Location *dst, const char *str)
+{
+  EmitLoadLabel(dst, NewStringConstant(str));
+}
+
+const char *Mips::NewStringConstant(const char *str)
 {
   static int strNum = 1;
+  if (poolData && stringLabels.count(str))
+    return stringLabels[str];
   char label[16];
   sprintf(label, "_string%d", strNum++);
+  if (poolData) {             // laid out by EmitDataSection
+    stringLabels[str] = strdup(label);
+    strings.push_back(std::make_pair(stringLabels[str], str));
+    return stringLabels[str];
+  }
   Emit(".data\t\t\t# create string constant marked with label");
   Emit("%s: .asciiz %s", label, str);
   Emit(".text");
-  EmitLoadLabel(dst, label);
+  return strdup(label);
 }
 
 
@@ -131,8 +395,9 @@ void Mips::EmitLoadStringConstant(Location *dst, const char *str)
  */
 void Mips::EmitLoadLabel(Location *dst, const char *label)
 {
-  Emit("la %s, %s\t# load label", regs[rd].name, label);
-  SpillRegister(dst, rd);
+  Register r = GetRegister(dst, ForWrite, rd);
+  Emit("la %s, %s\t# load label", regs[r].name, label);
+  StoreResult(dst, r);
 }
  
 
@@ -140,12 +405,20 @@ void Mips::EmitLoadLabel(Location *dst, const char *label)
  * ----------------
  * Used to copy the value of one variable to another.  Slaves both
  * src and dst into registers and then emits a move instruction to
- * copy the contents from src to dst.
+ * copy the contents from src to dst. When dst lives in memory, src's
+ * register is stored straight to it; when only dst has a register,
+ * src is loaded straight into it.
  */
 void Mips::EmitCopy(Location *dst, Location *src)
 {
-  FillRegister(src, rd);
-  SpillRegister(dst, rd);
+  Register d = HomeRegister(dst);
+  Register s = GetRegister(src, ForRead, d != zero ? d : rd);
+  if (d == zero)
+    d = GetRegister(dst, ForWrite, s);
+  if (d != s)
+    Emit("move %s, %s\t\t# copy %s to %s", regs[d].name, regs[s].name,
+         src->GetName(), dst->GetName());
+  StoreResult(dst, d);
 }
 
 
@@ -159,10 +432,11 @@ void Mips::EmitCopy(Location *dst, Location *src)
  */
 void Mips::EmitLoad(Location *dst, Location *reference, int offset)
 {
-  FillRegister(reference, rs);
-  Emit("lw %s, %d(%s) \t# load with offset", regs[rd].name,
-	 offset, regs[rs].name);
-  SpillRegister(dst, rd);
+  Register r = GetRegister(reference, ForRead, rs);
+  Register d = GetRegister(dst, ForWrite, rd);
+  Emit("lw %s, %d(%s) \t# load with offset", regs[d].name,
+	 offset, regs[r].name);
+  StoreResult(dst, d);
 }
 
 
@@ -176,10 +450,10 @@ void Mips::EmitLoad(Location *dst, Location *reference, int offset)
  */
 void Mips::EmitStore(Location *reference, Location *value, int offset)
 {
-  FillRegister(value, rs);
-  FillRegister(reference, rd);
+  Register v = GetRegister(value, ForRead, rs);
+  Register r = GetRegister(reference, ForRead, rd);
   Emit("sw %s, %d(%s) \t# store with offset",
-	 regs[rs].name, offset, regs[rd].name);
+	 regs[v].name, offset, regs[r].name);
 }
 
 
@@ -189,16 +463,82 @@ void Mips::EmitStore(Location *reference, Location *value, int offset)
  * in dst. All binary forms for arithmetic, logical, relational, equality
  * use this method. Slaves both operands and dst to registers, then
  * emits the appropriate instruction by looking up the mips name
- * for the particular op code.
+ * for the particular op code. MulHi is the one op that takes two
+ * instructions, reading the high word of the product from hi.
  */
 void Mips::EmitBinaryOp(BinaryOp::OpCode code, Location *dst, 
 				 Location *op1, Location *op2)
 {
-  FillRegister(op1, rs);
-  FillRegister(op2, rt);
-  Emit("%s %s, %s, %s\t", NameForTac(code), regs[rd].name,
-	 regs[rs].name, regs[rt].name);
-  SpillRegister(dst, rd);
+  Register r1 = GetRegister(op1, ForRead, rs);
+  Register r2 = GetRegister(op2, ForRead, rt);
+  Register d = GetRegister(dst, ForWrite, rd);
+  if (code == BinaryOp::MulHi) {
+    Emit("mult %s, %s", regs[r1].name, regs[r2].name);
+    Emit("mfhi %s", regs[d].name);
+  } else
+    Emit("%s %s, %s, %s\t", NameForTac(code), regs[d].name,
+	 regs[r1].name, regs[r2].name);
+  StoreResult(dst, d);
+}
+
+bool Mips::HasImmediateForm(BinaryOp::OpCode code, int value)
+{
+  switch (code) {
+    case BinaryOp::Add:
+    case BinaryOp::AddU:
+    case BinaryOp::Less:
+      return value >= -32768 && value <= 32767;
+    case BinaryOp::Sub:
+    case BinaryOp::Eq:          // these add the negated value
+      return value >= -32767 && value <= 32768;
+    case BinaryOp::And:
+    case BinaryOp::Or:          // andi/ori zero-extend their immediate
+      return value >= 0 && value <= 65535;
+    case BinaryOp::Shl:
+    case BinaryOp::Shr:
+    case BinaryOp::ShrU:
+      return value >= 0 && value <= 31;
+    default:
+      return false;
+  }
+}
+
+/* Method: EmitBinaryOp
+ * --------------------
+ * The version for a constant second operand, which goes directly in
+ * the instruction instead of having to be loaded in a register first.
+ * Add and Sub use addi (not addiu) so that overflow still traps just
+ * like add and sub do. There is no "seq" immediate form: x == c is
+ * computed as (x - c) <u 1, which is 1 only when x - c is zero.
+ */
+void Mips::EmitBinaryOp(BinaryOp::OpCode code, Location *dst,
+				 Location *op1, int imm)
+{
+  Assert(HasImmediateForm(code, imm));
+  Register r1 = GetRegister(op1, ForRead, rs);
+  Register d = GetRegister(dst, ForWrite, rd);
+  const char *rdName = regs[d].name, *r1Name = regs[r1].name;
+  switch (code) {
+    case BinaryOp::Add:  Emit("addi %s, %s, %d", rdName, r1Name, imm);  break;
+    case BinaryOp::AddU: Emit("addiu %s, %s, %d", rdName, r1Name, imm); break;
+    case BinaryOp::Sub:  Emit("addi %s, %s, %d", rdName, r1Name, -imm); break;
+    case BinaryOp::Less: Emit("slti %s, %s, %d", rdName, r1Name, imm);  break;
+    case BinaryOp::And:  Emit("andi %s, %s, %d", rdName, r1Name, imm);  break;
+    case BinaryOp::Or:   Emit("ori %s, %s, %d", rdName, r1Name, imm);   break;
+    case BinaryOp::Shl:  Emit("sll %s, %s, %d", rdName, r1Name, imm);   break;
+    case BinaryOp::Shr:  Emit("sra %s, %s, %d", rdName, r1Name, imm);   break;
+    case BinaryOp::ShrU: Emit("srl %s, %s, %d", rdName, r1Name, imm);   break;
+    case BinaryOp::Eq:
+      if (imm != 0) {
+        Emit("addiu %s, %s, %d", rdName, r1Name, -imm);
+        r1Name = rdName;
+      }
+      Emit("sltiu %s, %s, 1", rdName, r1Name);
+      break;
+    default:
+      Failure("No immediate form for Tac operator '%s'", BinaryOp::opName[code]);
+  }
+  StoreResult(dst, d);
 }
 
 
@@ -211,8 +551,9 @@ void Mips::EmitBinaryOp(BinaryOp::OpCode code, Location *dst,
  */
 void Mips::EmitLabel(const char *label)
 {
- 
+  SpillAllDirtyRegisters();
   Emit("%s:", label);
+  DiscardAllRegisters();
 }
 
 
@@ -225,7 +566,7 @@ void Mips::EmitLabel(const char *label)
  */
 void Mips::EmitGoto(const char *label)
 {
- 
+  SpillAllDirtyRegisters();
   Emit("b %s\t\t# unconditional branch", label);
 }
 
@@ -239,24 +580,85 @@ void Mips::EmitGoto(const char *label)
  */
 void Mips::EmitIfZ(Location *test, const char *label)
 {
-  FillRegister(test, rs);
-  Emit("beqz %s, %s\t# branch if %s is zero ", regs[rs].name, label,
+  Register r = GetRegister(test, ForRead, rs);
+  SpillAllDirtyRegisters();
+  Emit("beqz %s, %s\t# branch if %s is zero ", regs[r].name, label,
 	 test->GetName());
 }
 
 
+/* Method: EmitIfCmp
+ * -----------------
+ * Used for a branch on the comparison of two values, which is one
+ * MIPS branch instead of computing a boolean and testing it with
+ * beqz. Comparisons against constant zero use the single-register
+ * forms (bltz etc.), other constants the assembler's immediate forms.
+ */
+static const char *branchName[IfCmp::NumRelations] =
+  {"beq", "bne", "blt", "ble", "bgt", "bge"};
+
+void Mips::EmitIfCmp(IfCmp::Relation rel, Location *op1, Location *op2,
+		     const char *label)
+{
+  Register r1 = GetRegister(op1, ForRead, rs);
+  Register r2 = GetRegister(op2, ForRead, rt);
+  SpillAllDirtyRegisters();
+  Emit("%s %s, %s, %s", branchName[rel], regs[r1].name, regs[r2].name, label);
+}
+
+void Mips::EmitIfCmp(IfCmp::Relation rel, Location *op1, int imm,
+		     const char *label)
+{
+  Register r1 = GetRegister(op1, ForRead, rs);
+  SpillAllDirtyRegisters();
+  if (imm == 0)
+    Emit("%sz %s, %s", branchName[rel], regs[r1].name, label);
+  else
+    Emit("%s %s, %d, %s", branchName[rel], regs[r1].name, imm, label);
+}
+
+
+/* Method: EmitBoundsCheck
+ * -----------------------
+ * Used for an array subscript check. Compared unsigned, a negative
+ * index is above any length, so "0 <= index < length" is one bgeu
+ * off to the function's error stub (see EmitEndFunction). Nothing is
+ * spilled for the branch since the stub never comes back.
+ */
+void Mips::EmitBoundsCheck(Location *index, Location *length)
+{
+  Register r1 = GetRegister(index, ForRead, rs);
+  Register r2 = GetRegister(length, ForRead, rt);
+  if (!boundsError) boundsError = CodeGenerator::NewLabel();
+  Emit("bgeu %s, %s, %s\t# subscript out of bounds", regs[r1].name,
+       regs[r2].name, boundsError);
+}
+
+void Mips::EmitSizeCheck(Location *size)
+{
+  Register r = GetRegister(size, ForRead, rs);
+  if (!sizeError) sizeError = CodeGenerator::NewLabel();
+  Emit("bltz %s, %s\t# negative array size", regs[r].name, sizeError);
+}
+
+
 /* Method: EmitParam
  * -----------------
  * Used to push a parameter on the stack in anticipation of upcoming
  * function call. Decrements the stack pointer by 4. Slaves argument into
  * register and then stores contents to location just made at end of
- * stack.
+ * stack. When arguments are passed in registers, the parameter is only
+ * noted here; EmitArguments puts it in place at the call.
  */
 void Mips::EmitParam(Location *arg)
 { 
+  if (registerArgs) {
+    pendingParams.push_back(arg);
+    return;
+  }
   Emit("subu $sp, $sp, 4\t# decrement sp to make space for param");
-  FillRegister(arg, rs);
-  Emit("sw %s, 4($sp)\t# copy param value to stack", regs[rs].name);
+  Register r = GetRegister(arg, ForRead, rs);
+  Emit("sw %s, 4($sp)\t# copy param value to stack", regs[r].name);
 }
 
 
@@ -273,34 +675,74 @@ void Mips::EmitParam(Location *arg)
  */
 void Mips::EmitCallInstr(Location *result, const char *fn, bool isLabel)
 {
+  SpillAllDirtyRegisters();
+  DiscardAllRegisters();
   Emit("%s %-15s\t# jump to function", isLabel? "jal": "jalr", fn);
   if (result != NULL) {
+    Register r = GetRegister(result, ForWrite, rd);
     Emit("move %s, %s\t\t# copy function return value from $v0",
-    regs[rd].name, regs[v0].name);
-    SpillRegister(result, rd);
+    regs[r].name, regs[v0].name);
+    StoreResult(result, r);
   }
 }
 
 
-// Two covers for the above method for specific LCall/ACall variants
-void Mips::EmitLCall(Location *dst, const char *label)
+/* Method: EmitArguments
+ * ----------------------
+ * Passes the parameters noted by EmitParam when they are not pushed.
+ * They were noted in push order, last argument first. The n'th argument
+ * goes where the callee expects to find it, at n*4($sp) (which becomes
+ * n*4($fp) once the callee sets up its frame), except that with
+ * inRegisters the first four are passed in $a0-$a3 instead. The stack
+ * slots come from the outgoing area reserved by the prologue, so there
+ * is nothing to pop after the call.
+ */
+void Mips::EmitArguments(bool inRegisters)
+{
+  int n = pendingParams.size();
+  for (int k = 1; k <= n; k++) {
+    Location *arg = pendingParams[n - k];
+    if (inRegisters && k <= NumArgRegisters) {
+      Register a = (Register)(a0 + k - 1);
+      Register r = GetRegister(arg, ForRead, a);
+      if (r != a)
+        Emit("move %s, %s\t\t# pass %s in %s", regs[a].name, regs[r].name,
+             arg->GetName(), regs[a].name);
+    } else {
+      Register r = GetRegister(arg, ForRead, rt);
+      Emit("sw %s, %d($sp)\t# pass %s on stack", regs[r].name, 4 * k,
+           arg->GetName());
+    }
+  }
+  pendingParams.clear();
+}
+
+
+// Two covers for the above method for specific LCall/ACall variants.
+// The runtime library expects all of its arguments on the stack.
+void Mips::EmitLCall(Location *dst, const char *label, bool isBuiltIn)
 { 
+  if (registerArgs)
+    EmitArguments(!isBuiltIn);
   EmitCallInstr(dst, label, true);
 }
 
 void Mips::EmitACall(Location *dst, Location *fn)
 {
-  FillRegister(fn, rs);
-  EmitCallInstr(dst, regs[rs].name, false);
+  if (registerArgs)
+    EmitArguments(true);
+  Register r = GetRegister(fn, ForRead, rs);
+  EmitCallInstr(dst, regs[r].name, false);
 }
 
 /*
  * We remove all parameters from the stack after a completed call
- * by adjusting the stack pointer upwards.
+ * by adjusting the stack pointer upwards. Nothing to do when they
+ * went in the reserved outgoing area.
  */
 void Mips::EmitPopParams(int bytes)
 {
-  if (bytes != 0)
+  if (bytes != 0 && !registerArgs)
     Emit("add $sp, $sp, %d\t# pop params off stack", bytes);
 }
 
@@ -318,16 +760,31 @@ void Mips::EmitPopParams(int bytes)
  * which is to remove our locals/temps from the stack, remove
  * saved registers ($fp and $ra) and restore previous values of
  * $fp and $ra so everything is returned to the state we entered.
- * We then emit jr to jump to the saved $ra.
+ * Any callee-saved registers the function was allocated are restored
+ * as well. We then emit jr to jump to the saved $ra.
  */
  void Mips::EmitReturn(Location *returnVal)
 { 
   if (returnVal != NULL) 
     {
-      FillRegister(returnVal, rd);
+      Register r = GetRegister(returnVal, ForRead, rd);
       Emit("move $v0, %s\t\t# assign return value into $v0",
-	   regs[rd].name);
+	   regs[r].name);
     }
+  SpillForEndFunction();
+  DiscardAllRegisters();
+  for (int i = 0; i < savedRegisters.size(); i++)
+    Emit("lw %s, %d(%s)\t# restore saved %s", regs[savedRegisters[i]].name,
+         FrameOffset(SavedRegisterOffset(i)), FrameBase(),
+         regs[savedRegisters[i]].name);
+  if (omitFramePointer) {
+    if (!isLeaf)
+      Emit("lw $ra, %d($sp)\t# restore saved ra", frameBytes - 4);
+    if (frameBytes != 0)
+      Emit("addiu $sp, $sp, %d\t# pop callee frame off stack", frameBytes);
+    Emit("jr $ra\t\t# return from function");
+    return;
+  }
   Emit("move $sp, $fp\t\t# pop callee frame off stack");
   Emit("lw $ra, -4($fp)\t# restore saved ra");
   Emit("lw $fp, 0($fp)\t# restore saved fp");
@@ -341,19 +798,74 @@ void Mips::EmitPopParams(int bytes)
  * upon entering a new function. We decrement the $sp to make space
  * and then save the current values of $fp and $ra (since we are
  * going to change them), then set up the $fp and bump the $sp down
- * to make space for all our locals/temps.
+ * to make space for all our locals/temps. When registers have been
+ * allocated, the callee-saved ones we use are saved just below the
+ * locals/temps and parameters living in registers are loaded. With
+ * arguments in registers, the outgoing argument area is reserved at
+ * the bottom of the frame, and each parameter arriving in $a0-$a3 is
+ * moved to its register, or stored to its slot if it has none.
+ *
+ * Without a frame pointer the frame has the same layout, but it is
+ * made with a single adjustment of $sp and $fp is never touched. A
+ * leaf function doesn't save $ra, and one with nothing at all to
+ * keep in its frame doesn't make one. Whenever AllocateRegisters has
+ * packed the locals/temps, their slots take localBytes, not the size
+ * BeginFunc reserved for all of them.
  */
 void Mips::EmitBeginFunction(int stackFrameSize)
 {
   Assert(stackFrameSize >= 0);
-  Emit("subu $sp, $sp, 8\t# decrement sp to make space to save ra, fp");
-  Emit("sw $fp, 8($sp)\t# save fp");
-  Emit("sw $ra, 4($sp)\t# save ra");
-  Emit("addiu $fp, $sp, 8\t# set up new fp");
+  if (localBytes >= 0)
+    stackFrameSize = localBytes;
+  frameSize = stackFrameSize;
+  DiscardAllRegisters();
 
-  if (stackFrameSize != 0)
-    Emit("subu $sp, $sp, %d\t# decrement sp to make space for locals/temps",
+  stackFrameSize += 4 * savedRegisters.size();
+  if (registerArgs)
+    stackFrameSize += 4 * outgoingArgs;
+  if (omitFramePointer) {
+    bool empty = isLeaf && stackFrameSize == 0;
+    frameBytes = empty ? 0 : stackFrameSize + 8;
+    if (frameBytes != 0)
+      Emit("subu $sp, $sp, %d\t# decrement sp to make space for frame",
+           frameBytes);
+    if (!isLeaf)
+      Emit("sw $ra, %d($sp)\t# save ra", frameBytes - 4);
+  } else {
+    Emit("subu $sp, $sp, 8\t# decrement sp to make space to save ra, fp");
+    Emit("sw $fp, 8($sp)\t# save fp");
+    Emit("sw $ra, 4($sp)\t# save ra");
+    Emit("addiu $fp, $sp, 8\t# set up new fp");
+    if (stackFrameSize != 0)
+      Emit("subu $sp, $sp, %d\t# decrement sp to make space for locals/temps",
 	   stackFrameSize);
+  }
+  boundsError = sizeError = NULL;
+  for (int i = 0; i < savedRegisters.size(); i++)
+    Emit("sw %s, %d(%s)\t# save %s", regs[savedRegisters[i]].name,
+         FrameOffset(SavedRegisterOffset(i)), FrameBase(),
+         regs[savedRegisters[i]].name);
+  for (int i = 0; i < entryParams.size(); i++) {
+    Location *param = entryParams[i];
+    Register home = HomeRegister(param);
+    int argNum = param->GetOffset() / 4;
+    if (registerArgs && argNum <= NumArgRegisters) {
+      Register a = (Register)(a0 + argNum - 1);
+      if (home != zero)
+        Emit("move %s, %s\t\t# param %s arrives in %s", regs[home].name,
+             regs[a].name, param->GetName(), regs[a].name);
+      else
+        SpillRegister(param, a);
+    } else if (home != zero)
+      FillRegister(param, home);
+  }
+}
+
+
+// Saved registers go in the slots below the last local/temp
+int Mips::SavedRegisterOffset(int i)
+{
+  return -8 - frameSize - 4 * i;
 }
 
 
@@ -367,6 +879,27 @@ void Mips::EmitEndFunction()
 { 
   Emit("# (below handles reaching end of fn body with no explicit return)");
   EmitReturn(NULL);
+  if (boundsError) EmitErrorStub(boundsError, err_arr_out_of_bounds);
+  if (sizeError) EmitErrorStub(sizeError, err_arr_bad_size);
+}
+
+/* Method: EmitErrorStub
+ * ---------------------
+ * Emits the code the failed checks of a function branch to: it prints
+ * the message by way of the runtime library, as the inline checks at
+ * -O0 do, and halts. It is out of the way after the function's return.
+ */
+void Mips::EmitErrorStub(const char *label, const char *message)
+{
+  char *str = new char[strlen(message) + 3];
+  sprintf(str, "\"%s\"", message);
+  const char *strLabel = NewStringConstant(str);
+  Emit("%s:", label);
+  Emit("la $v0, %s\t# load label", strLabel);
+  Emit("subu $sp, $sp, 4\t# decrement sp to make space for param");
+  Emit("sw $v0, 4($sp)\t# copy param value to stack");
+  Emit("jal %-15s\t# jump to function", "_PrintString");
+  Emit("jal %-15s\t# jump to function", "_Halt");
 }
 
 
@@ -375,16 +908,25 @@ void Mips::EmitEndFunction()
  * ------------------
  * Used to layout a vtable. Uses assembly directives to set up new
  * entry in data segment, emits label, and lays out the function
- * labels one after another.
+ * labels one after another, a 0 for a slot left empty.
  */
 void Mips::EmitVTable(const char *label, List<const char*> *methodLabels)
 {
+  if (poolData) {             // laid out by EmitDataSection
+    vtables.push_back(std::make_pair(label, methodLabels));
+    return;
+  }
   Emit(".data");
   Emit(".align 2");
+  LayOutVTable(label, methodLabels);
+  Emit(".text");
+}
+
+void Mips::LayOutVTable(const char *label, List<const char*> *methodLabels)
+{
   Emit("%s:\t\t# label for class %s vtable", label, label);
   for (int i = 0; i < methodLabels->NumElements(); i++)
-    Emit(".word %s\n", methodLabels->Nth(i));
-  Emit(".text");
+    Emit(".word %s\n", methodLabels->Nth(i) ? methodLabels->Nth(i) : "0");
 }
 
 
@@ -403,6 +945,26 @@ void Mips::EmitPreamble()
 }
 
 
+/* Method: EmitDataSection
+ * ------------------------
+ * Used after the last function to lay out the vtables and string
+ * constants pooled while emitting the code, all in one data segment
+ * entry with the vtables first to keep them word-aligned. Ends back in
+ * the text segment, as every entry does.
+ */
+void Mips::EmitDataSection()
+{
+  if (vtables.empty() && strings.empty()) return;
+  Emit(".data");
+  Emit(".align 2");
+  for (int i = 0; i < vtables.size(); i++)
+    LayOutVTable(vtables[i].first, vtables[i].second);
+  for (int i = 0; i < strings.size(); i++)
+    Emit("%s: .asciiz %s", strings[i].first, strings[i].second);
+  Emit(".text");              // for the runtime library appended after
+}
+
+
 /* Method: NameForTac
  * ------------------
  * Returns the appropriate MIPS instruction (add, seq, etc.) for
@@ -432,6 +994,10 @@ Mips::Mips() {
   mipsName[BinaryOp::Less] = "slt";
   mipsName[BinaryOp::And] = "and";
   mipsName[BinaryOp::Or] = "or";
+  mipsName[BinaryOp::Shl] = "sllv";
+  mipsName[BinaryOp::Shr] = "srav";
+  mipsName[BinaryOp::ShrU] = "srlv";
+  mipsName[BinaryOp::AddU] = "addu";
   regs[zero] = (RegContents){false, NULL, "$zero", false};
   regs[at] = (RegContents){false, NULL, "$at", false};
   regs[v0] = (RegContents){false, NULL, "$v0", false};
@@ -465,6 +1031,20 @@ Mips::Mips() {
   regs[s6] = (RegContents){false, NULL, "$s6", true};
   regs[s7] = (RegContents){false, NULL, "$s7", true};
   rs = t0; rt = t1; rd = t2;
+  if (GetOptimizationLevel() > 1) { // t0-t7 are handed out by the allocator
+    rs = t8; rt = t9; rd = v1;
+  }
+  cacheRegisters = (GetOptimizationLevel() == 1);
+  registerArgs = (GetOptimizationLevel() > 1);
+  poolData = (GetOptimizationLevel() > 0);
+  outgoingArgs = 0;
+  omitFramePointer = registerArgs;
+  isLeaf = false;
+  localBytes = -1;
+  frameBytes = 0;
+  boundsError = sizeError = NULL;
+  instructionNum = 0;
+  frameSize = 0;
 
 }
 const char *Mips::mipsName[BinaryOp::NumOps];
@@ -18,6 +18,9 @@
 #ifndef _H_mips
 #define _H_mips
 
+#include <map>
+#include <string>
+#include <vector>
 #include "tac.h"
 #include "list.h"
 class Location;
@@ -35,16 +38,77 @@ class Mips {
 	Location *var;
 	const char *name;
 	bool isGeneralPurpose;
+	int lastUse;            // instruction number, for LRU replacement
     } regs[NumRegs];
 
     Register rs, rt, rd;
 
     typedef enum { ForRead, ForWrite } Reason;
+
+      // at -O1 registers cache variables for the span of a basic block
+    bool cacheRegisters;
+    int instructionNum;
+
+      // register assignment for the function being emitted (-O2 and up);
+      // regs[] can't hold it, as one register is home to every variable
+      // whose live interval it was given, and regs[].var stays for the
+      // -O1 cache of what a register holds at the current instruction
+    std::map<Location*, Register> homeRegister;
+    std::vector<Register> savedRegisters;
+    std::vector<Location*> entryParams;
+    int frameSize;
+
+      // at -O2 the first arguments are passed in $a0-$a3 and the rest
+      // are stored in an outgoing area reserved once by the prologue
+    static const int NumArgRegisters = 4;
+    bool registerArgs;
+    std::vector<Location*> pendingParams;
+    int outgoingArgs;
+
+      // with the frame fixed in size, the frame is addressed off $sp
+      // and $fp is left alone; leaf functions don't save $ra, and a
+      // frame with nothing to hold is not set up at all
+    bool omitFramePointer;
+    bool isLeaf;
+    int frameBytes;
+
+      // bytes of stack slots for locals/temps once the slots have been
+      // packed by AllocateRegisters, -1 to use the size BeginFunc gives
+    int localBytes;
+
+      // labels of the code after the function that reports a failed
+      // bounds or size check and halts, NULL while no check needed it
+    const char *boundsError, *sizeError;
+
+      // at -O1 and up string constants and vtables are laid out in a
+      // single data section after the code, each distinct string once
+    bool poolData;
+    std::map<std::string, const char*> stringLabels;
+    std::vector<std::pair<const char*, const char*> > strings;   // label, text
+    std::vector<std::pair<const char*, List<const char*>*> > vtables;
     
     void FillRegister(Location *src, Register reg);
     void SpillRegister(Location *dst, Register reg);
 
+    Register HomeRegister(Location *var);
+    Register GetRegister(Location *var, Reason reason, Register scratch);
+    void StoreResult(Location *dst, Register reg);
+    Register FindRegisterWithContents(Location *var);
+    void DiscardSlotSharers(Location *var);
+    Register SelectRegisterToSpill();
+    void SpillAllDirtyRegisters();
+    void SpillForEndFunction();
+    void DiscardAllRegisters();
+    int SavedRegisterOffset(int i);
+    const char *FrameBase();
+    int FrameOffset(int fpOffset);
+
+    const char *NewStringConstant(const char *str);
+    void EmitErrorStub(const char *label, const char *message);
+    void LayOutVTable(const char *label, List<const char*> *methodLabels);
+
     void EmitCallInstr(Location *dst, const char *fn, bool isL);
+    void EmitArguments(bool inRegisters);
     
     static const char *mipsName[BinaryOp::NumOps];
     static const char *NameForTac(BinaryOp::OpCode code);
@@ -54,6 +118,8 @@ class Mips {
     Mips();
 
     static void Emit(const char *fmt, ...);
+
+    void AllocateRegisters(const std::vector<Instruction*> &fn);
     
     void EmitLoadConstant(Location *dst, int val);
     void EmitLoadStringConstant(Location *dst, const char *str);
@@ -65,23 +131,37 @@ class Mips {
 
     void EmitBinaryOp(BinaryOp::OpCode code, Location *dst, 
 			    Location *op1, Location *op2);
+    void EmitBinaryOp(BinaryOp::OpCode code, Location *dst,
+			    Location *op1, int imm);
+
+         // True if "op1 code value" can be done with the constant as
+         // an immediate operand (a 16-bit field for the MIPS i-forms).
+    static bool HasImmediateForm(BinaryOp::OpCode code, int value);
 
     void EmitLabel(const char *label);
     void EmitGoto(const char *label);
     void EmitIfZ(Location *test, const char*label);
+    void EmitIfCmp(IfCmp::Relation rel, Location *op1, Location *op2,
+		   const char *label);
+    void EmitIfCmp(IfCmp::Relation rel, Location *op1, int imm,
+		   const char *label);
     void EmitReturn(Location *returnVal);
 
+    void EmitBoundsCheck(Location *index, Location *length);
+    void EmitSizeCheck(Location *size);
+
     void EmitBeginFunction(int frameSize);
     void EmitEndFunction();
 
     void EmitParam(Location *arg);
-    void EmitLCall(Location *result, const char* label);
+    void EmitLCall(Location *result, const char* label, bool isBuiltIn);
     void EmitACall(Location *result, Location *fnAddr);
     void EmitPopParams(int bytes);
 
     void EmitVTable(const char *label, List<const char*> *methodLabels);
 
     void EmitPreamble();
+    void EmitDataSection();
 
   
     class CurrentInstruction;
@@ -96,6 +176,7 @@ public:
     : mips( mips )
   {
     mips.currentInstruction= instr;
+    mips.instructionNum++;
   }
 
   ~CurrentInstruction()
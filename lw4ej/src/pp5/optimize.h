@@ -0,0 +1,106 @@
+/* File: optimize.h
+ * ----------------
+ * The optimization passes that work on one function at a time. Each
+ * takes the function's FlowGraph in SSA form (see ssa.h) and leaves it
+ * in SSA form. One that may change the branches or the blocks keeps
+ * the edges up to date but not the dominators and loops (see cfg.h),
+ * and returns true if it did change them. Those working on the whole
+ * program, declared after these, run before them; they take the Tac of
+ * all functions as one list. The PassManager (see passmanager.h)
+ * decides which run and in what order.
+ */
+
+#ifndef _H_optimize
+#define _H_optimize
+
+#include <list>
+#include <map>
+#include "cfg.h"
+#include "ssa.h"
+
+         // Sparse conditional constant propagation: finds the variables
+         // with a constant value and the blocks that can't be reached
+         // because a test is constant, then loads the constants, folds
+         // them into immediate operands, turns constant tests into
+         // Gotos and deletes the blocks no longer reached.
+bool PropagateConstants(FlowGraph *graph);
+
+         // Makes the reads of a copy read the variable copied instead,
+         // and deletes the copies.
+void PropagateCopies(FlowGraph *graph);
+
+         // Dominator-based value numbering: deletes the BinaryOps,
+         // LoadLabels and Loads computing what an instruction in a
+         // dominating block already did, as long as no Store or call
+         // in between may have changed what a Load reads.
+void NumberValues(FlowGraph *graph);
+
+         // Escape analysis: replaces the objects and constant-size
+         // arrays that never leave the function, and are only written
+         // in the block allocating them, by the values stored in them.
+void ReplaceScalars(FlowGraph *graph);
+
+         // Range analysis: settles the tests and deletes the array
+         // bounds and size checks whose outcome follows from the tests
+         // and checks on the way to them and from which variables can't
+         // be negative.
+bool EliminateBoundsChecks(FlowGraph *graph);
+
+         // Moves the computations that give the same result in every
+         // iteration of a loop, and reads of globals the loop doesn't
+         // write, to a block run once before it (its preheader).
+void HoistLoopInvariants(FlowGraph *graph, SSA *ssa);
+
+         // Replaces the array element addresses recomputed from a loop
+         // counter in each iteration by pointers stepped along with it,
+         // and the counter by the pointer in the loop's tests when it
+         // isn't needed otherwise. Needs the loops to have preheaders.
+void ReduceInductionVariables(FlowGraph *graph, SSA *ssa);
+
+         // Deletes the instructions that compute a value never used.
+void EliminateDeadCode(FlowGraph *graph);
+
+         // Replaces the ACalls on objects created in the same function,
+         // whose class is then known, by LCalls of the method called.
+void DevirtualizeCalls(std::list<Instruction*> &code);
+
+         // Replaces the calls of functions and methods to themselves
+         // in tail position by assigning the arguments to the
+         // parameters and jumping back to the start of the body.
+void EliminateTailCalls(std::list<Instruction*> &code);
+
+         // Replaces the LCalls of small functions and methods by a copy
+         // of their body, with the arguments assigned to new variables
+         // standing for the parameters.
+void InlineCalls(std::list<Instruction*> &code);
+
+         // Deletes the functions and methods that can't be called from
+         // main and the vtables of the classes it never creates objects
+         // of, and empties the vtable slots of the methods deleted.
+void RemoveUnreachableFunctions(std::list<Instruction*> &code);
+
+
+// What the passes moving or reusing Loads assume about which Stores
+// and calls may change the word a Load reads (see memory.cc).
+class MemoryModel
+{
+  public:
+    MemoryModel(FlowGraph *graph);
+
+         // True for a Store or a call that isn't to a built-in.
+    static bool ChangesMemory(Instruction *instr);
+
+         // True if clobber may change the word at base + offset.
+    bool MayChange(Instruction *clobber, Location *base, int offset);
+
+  private:
+    typedef enum { None, Start, Computed, Unknown } AddressKind;
+    std::map<Location*, Instruction*> definition;
+    std::map<Location*, AddressKind> kinds;
+
+    AddressKind KindOf(Location *var);
+    bool IsVTable(Location *var);
+    bool CantChange(Location *base, int offset);
+};
+
+#endif
@@ -0,0 +1,235 @@
+/* File: passmanager.cc
+ * --------------------
+ * Implementation of the PassManager: the pipeline of passes, which of
+ * them the command line turns on, and the timing report.
+ */
+
+#include "passmanager.h"
+#include "codegen.h"
+#include "cfg.h"
+#include "ssa.h"
+#include "optimize.h"
+#include "utility.h"
+#include "list.h"
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+
+static void UnusedConstants(CodeGenerator *cg, std::list<Instruction*> &code)
+{
+  cg->RemoveUnusedConstants();
+}
+
+static void Devirtualize(CodeGenerator *, std::list<Instruction*> &code) { DevirtualizeCalls(code); }
+static void TailCalls(CodeGenerator *, std::list<Instruction*> &code) { EliminateTailCalls(code); }
+static void Inline(CodeGenerator *, std::list<Instruction*> &code) { InlineCalls(code); }
+static void Prune(CodeGenerator *, std::list<Instruction*> &code) { RemoveUnreachableFunctions(code); }
+
+// A function pass returns true if it changed the branches or blocks,
+// leaving the dominators and loops to analyze again; LICM analyzes
+// the graph itself after adding preheaders.
+static bool ConstProp(FlowGraph *graph, SSA *) { return PropagateConstants(graph); }
+static bool CopyProp(FlowGraph *graph, SSA *) { PropagateCopies(graph); return false; }
+static bool ValueNumbering(FlowGraph *graph, SSA *) { NumberValues(graph); return false; }
+static bool Scalars(FlowGraph *graph, SSA *) { ReplaceScalars(graph); return false; }
+static bool BoundsChecks(FlowGraph *graph, SSA *) { return EliminateBoundsChecks(graph); }
+static bool Licm(FlowGraph *graph, SSA *ssa) { HoistLoopInvariants(graph, ssa); return false; }
+static bool Induction(FlowGraph *graph, SSA *ssa)
+{
+  ReduceInductionVariables(graph, ssa);
+  return false;
+}
+static bool DeadCode(FlowGraph *graph, SSA *) { EliminateDeadCode(graph); return false; }
+
+static struct _pass {
+  const char *name;
+  int level;                  // lowest -O level it runs at
+  void (*onProgram)(CodeGenerator *cg, std::list<Instruction*> &code);
+  bool (*onFunction)(FlowGraph *graph, SSA *ssa);
+  bool usesDominators;        // the dominator tree or the loops
+} pipeline[] =
+ {{"unused-constants", 1, UnusedConstants, NULL, false},
+  {"devirtualize", 2, Devirtualize, NULL, false},
+  {"tail-calls", 2, TailCalls, NULL, false},
+  {"inline", 2, Inline, NULL, false},
+  {"devirtualize", 2, Devirtualize, NULL, false},  // calls on the receivers of inlined methods
+  {"prune", 2, Prune, NULL, false},
+  {"const-prop", 2, NULL, ConstProp, false},
+  {"copy-prop", 2, NULL, CopyProp, false},
+  {"value-numbering", 2, NULL, ValueNumbering, true},
+  {"scalar-replacement", 2, NULL, Scalars, false},
+  {"bounds-checks", 2, NULL, BoundsChecks, true},
+  {"licm", 2, NULL, Licm, true},
+  {"induction-vars", 2, NULL, Induction, true},
+  {"dead-code", 2, NULL, DeadCode, false}};
+
+static const int NumPasses = sizeof(pipeline) / sizeof(pipeline[0]);
+
+static double SecondsSince(clock_t start)
+{
+  return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+static int SizeOf(FlowGraph *graph)
+{
+  int size = 0;
+  for (int b = 0; b < graph->blocks.size(); b++)
+    size += graph->blocks[b]->code.size();
+  return size;
+}
+
+static bool IsPass(const char *name)
+{
+  for (int p = 0; p < NumPasses; p++)
+    if (!strcmp(pipeline[p].name, name)) return true;
+  return false;
+}
+
+void PassManager::CheckPassNames()
+{
+  List<const char*> *names = GetPassesNamed();
+  for (int i = 0; i < names->NumElements(); i++) {
+    if (IsPass(names->Nth(i))) continue;
+    printf("Unknown pass '%s'; the passes are:", names->Nth(i));
+    for (int p = 0; p < NumPasses; p++) {
+      int first = 0;                            // a pass may be in twice
+      while (strcmp(pipeline[first].name, pipeline[p].name)) first++;
+      if (first == p) printf(" %s", pipeline[p].name);
+    }
+    printf("\n");
+    exit(2);
+  }
+}
+
+PassManager::PassManager(CodeGenerator *g, std::list<Instruction*> &c)
+  : cg(g), code(c), seconds(NumPasses), before(NumPasses), after(NumPasses),
+    ssaSeconds(0), analysisSeconds(0), analyses(0), printedSSA(false) {}
+
+bool PassManager::IsEnabled(const char *name)
+{
+  for (int p = 0; p < NumPasses; p++)
+    if (!strcmp(pipeline[p].name, name)) return IsEnabled(p);
+  return false;
+}
+
+bool PassManager::IsEnabled(int pass)
+{
+  if (GetOptimizationLevel() == 0) return false;
+  int setting = GetPassSetting(pipeline[pass].name);
+  return setting >= 0 ? setting : GetOptimizationLevel() >= pipeline[pass].level;
+}
+
+/* Method: RunOnFunctions
+ * ----------------------
+ * Runs the function passes from first to last on each function in
+ * turn: builds its flow graph, puts it in SSA form, runs the passes
+ * enabled, goes back out of SSA form and splices the resulting code
+ * in place of the original. The dominators and loops, once a pass has
+ * changed the branches or blocks, are only analyzed again before the
+ * next pass that uses them, or leaving SSA form, which does. With -d
+ * ssa, prints the code with each function's optimized flow graph as
+ * it is in SSA form.
+ */
+void PassManager::RunOnFunctions(int first, int last)
+{
+  bool any = false;
+  for (int pass = first; pass <= last; pass++)
+    if (IsEnabled(pass)) any = true;
+  if (!any) return;
+
+  std::list<Instruction*>::iterator p = code.begin();
+  while (p != code.end()) {
+    if (!dynamic_cast<BeginFunc*>(*p)) {
+      if (IsDebugOn("ssa")) (*p)->Print();
+      ++p;
+      continue;
+    }
+    clock_t start = clock();
+    FlowGraph graph(FlowGraph::FunctionAt(p));
+    SSA ssa(&graph);
+    ssaSeconds += SecondsSince(start);
+    bool analyzed = true;
+    for (int pass = first; pass <= last; pass++) {
+      if (!IsEnabled(pass)) continue;
+      if (!analyzed && pipeline[pass].usesDominators) {
+        Analyze(&graph);
+        analyzed = true;
+      }
+      before[pass] += SizeOf(&graph);
+      start = clock();
+      if (pipeline[pass].onFunction(&graph, &ssa)) analyzed = false;
+      seconds[pass] += SecondsSince(start);
+      after[pass] += SizeOf(&graph);
+    }
+    if (!analyzed) Analyze(&graph);
+    if (IsDebugOn("ssa")) {
+      graph.Print();
+      printedSSA = true;
+    }
+
+    start = clock();
+    ssa.Destroy();
+    std::list<Instruction*>::iterator end = p;
+    while (!dynamic_cast<EndFunc*>(*end++)) ;
+    std::vector<Instruction*> fn = graph.Linearize();
+    p = code.erase(p, end);
+    code.insert(p, fn.begin(), fn.end());
+    ssaSeconds += SecondsSince(start);
+  }
+}
+
+void PassManager::Analyze(FlowGraph *graph)
+{
+  clock_t start = clock();
+  graph->Analyze();
+  analysisSeconds += SecondsSince(start);
+  analyses++;
+}
+
+void PassManager::Run()
+{
+  for (int pass = 0; pass < NumPasses; ) {
+    if (pipeline[pass].onFunction) {
+      int last = pass;
+      while (last + 1 < NumPasses && pipeline[last + 1].onFunction) last++;
+      RunOnFunctions(pass, last);
+      pass = last + 1;
+      continue;
+    }
+    if (IsEnabled(pass)) {
+      before[pass] += code.size();
+      clock_t start = clock();
+      pipeline[pass].onProgram(cg, code);
+      seconds[pass] += SecondsSince(start);
+      after[pass] += code.size();
+    }
+    pass++;
+  }
+  if (IsTimePassesOn())
+    PrintReport();
+}
+
+/* Method: PrintReport
+ * -------------------
+ * Prints, for each pass run, its time and the number of Tac
+ * instructions before and after it: of the whole program for a pass
+ * on it, summed over the functions (phis included) for the others.
+ * Then the time taken analyzing flow graphs again between passes, and
+ * how many times it was done.
+ */
+void PassManager::PrintReport()
+{
+  double total = ssaSeconds + analysisSeconds;
+  fprintf(stderr, "=== Pass execution report (-O%d) ===\n", GetOptimizationLevel());
+  fprintf(stderr, "  %-20s %9s %8s %8s %8s\n", "pass", "seconds", "before", "after", "change");
+  for (int pass = 0; pass < NumPasses; pass++) {
+    if (!IsEnabled(pass)) continue;
+    fprintf(stderr, "  %-20s %9.4f %8d %8d %+8d\n", pipeline[pass].name, seconds[pass],
+            before[pass], after[pass], after[pass] - before[pass]);
+    total += seconds[pass];
+  }
+  fprintf(stderr, "  %-20s %9.4f %8d times\n", "(reanalysis)", analysisSeconds, analyses);
+  fprintf(stderr, "  %-20s %9.4f\n", "(in and out of ssa)", ssaSeconds);
+  fprintf(stderr, "  %-20s %9.4f\n", "total", total);
+}
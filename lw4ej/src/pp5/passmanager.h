@@ -0,0 +1,72 @@
+/* File: passmanager.h
+ * -------------------
+ * The PassManager runs the optimization passes between the generation
+ * of the Tac and its translation to MIPS, in a fixed pipeline order.
+ * Which passes run is first set by the -O level (each pass has a
+ * lowest level it is on at) and then by -f<pass> and -fno-<pass> on
+ * the command line, which turn a pass on or off by name. -O0 is the
+ * plain translation and runs none, whatever the flags.
+ *
+ * Passes on the whole program take the Tac of all functions as one
+ * list. A run of consecutive passes on one function at a time shares
+ * the function's flow graph and SSA form (see optimize.h), the
+ * analyses they work on: built once before the first of them, and only
+ * given up, the function going back to a list, when the run ends. Each
+ * pass keeps the SSA form and the edges up to date. One that changes
+ * the branches or blocks says so, and the dominators and loops are
+ * then analyzed again before the next pass that uses them.
+ *
+ * With -time-passes, a report of the time each pass took and how many
+ * Tac instructions it added or deleted is printed on stderr.
+ */
+
+#ifndef _H_passmanager
+#define _H_passmanager
+
+#include <list>
+#include <vector>
+#include "tac.h"
+
+class CodeGenerator;
+class FlowGraph;
+class SSA;
+
+
+class PassManager
+{
+  public:
+         // Checks that the -f and -fno- flags name passes; if one
+         // doesn't, prints the names of the passes and exits.
+    static void CheckPassNames();
+
+         // True if the pass named name runs, given the -O level and the
+         // -f flags; for the parts of a pass done as the Tac is made.
+    static bool IsEnabled(const char *name);
+
+    PassManager(CodeGenerator *cg, std::list<Instruction*> &code);
+
+         // Runs the pipeline on the code, then prints the timing
+         // report if asked for.
+    void Run();
+
+         // True if the code was printed in SSA form for -d ssa, which
+         // it isn't when no pass on functions runs.
+    bool PrintedSSA() { return printedSSA; }
+
+  private:
+    CodeGenerator *cg;
+    std::list<Instruction*> &code;
+    std::vector<double> seconds;                // per pipeline entry
+    std::vector<int> before, after;             // Tac instructions
+    double ssaSeconds;                          // building and leaving SSA
+    double analysisSeconds;                     // analyzing again after a pass
+    int analyses;
+    bool printedSSA;
+
+    static bool IsEnabled(int pass);
+    void RunOnFunctions(int first, int last);
+    void Analyze(FlowGraph *graph);
+    void PrintReport();
+};
+
+#endif
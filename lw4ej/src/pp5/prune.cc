@@ -0,0 +1,146 @@
+/* File: prune.cc
+ * --------------
+ * Removal of the functions, methods and vtables the program can never
+ * use, on the Tac of the whole program once calls are inlined.
+ *
+ * Starting from main, a function reached makes reached the functions
+ * it calls with an LCall and the classes whose vtable it loads, which
+ * is what a NewExpr does. A method is reached when it is in the vtable
+ * of a class reached at an offset some ACall loads its method from; an
+ * ACall whose method address doesn't come from a single Load makes
+ * every offset count. The functions not reached are deleted, as are
+ * the vtables of the classes not reached, and the slots of the vtables
+ * kept whose method isn't reached are left empty.
+ */
+
+#include "optimize.h"
+#include "codegen.h"
+#include <set>
+#include <string>
+
+typedef std::list<Instruction*>::iterator Position;
+
+class Reachability
+{
+  public:
+    Reachability(std::list<Instruction*> &code);
+    void Run();
+
+  private:
+    std::list<Instruction*> &code;
+    std::map<std::string, Position> functions;  // the Label before each BeginFunc
+    std::map<std::string, VTable*> vtables;
+    std::set<std::string> reached, scanned, classes;
+    std::set<int> offsets;                      // of the methods ACalls load
+    bool anyOffset;
+
+    void Scan(Position label);
+    bool ReachMethods();
+};
+
+Reachability::Reachability(std::list<Instruction*> &c) : code(c), anyOffset(false) {}
+
+/* Method: Scan
+ * ------------
+ * Notes what the function starting at label calls, the classes it
+ * creates objects of and the vtable offsets it calls methods at.
+ */
+void Reachability::Scan(Position label)
+{
+  std::map<Location*, Instruction*> definition;
+  std::map<Location*, int> definitions;
+  Position p;
+  for (p = label; !dynamic_cast<EndFunc*>(*p); ++p)
+    if (Location *dst = (*p)->GetDst()) {
+      definition[dst] = *p;
+      definitions[dst]++;
+    }
+
+  for (p = label; !dynamic_cast<EndFunc*>(*p); ++p) {
+    if (LCall *call = dynamic_cast<LCall*>(*p)) {
+      if (!call->IsBuiltIn()) reached.insert(call->GetLabel());
+    } else if (LoadLabel *load = dynamic_cast<LoadLabel*>(*p)) {
+      if (vtables.count(load->GetLabel())) classes.insert(load->GetLabel());
+      else if (functions.count(load->GetLabel())) reached.insert(load->GetLabel());
+    } else if (ACall *call = dynamic_cast<ACall*>(*p)) {
+      Location *addr = call->GetSrc(0);
+      Load *method = (definitions[addr] == 1) ? dynamic_cast<Load*>(definition[addr]) : NULL;
+      if (method) offsets.insert(method->GetOffset());
+      else anyOffset = true;
+    }
+  }
+}
+
+// Reaches the methods of the classes reached at the offsets called;
+// returns true if any wasn't reached yet.
+bool Reachability::ReachMethods()
+{
+  bool changed = false;
+  std::set<std::string>::iterator c;
+  for (c = classes.begin(); c != classes.end(); ++c) {
+    List<const char*> *methods = vtables[*c]->GetMethodLabels();
+    for (int i = 0; i < methods->NumElements(); i++)
+      if ((anyOffset || offsets.count(i * CodeGenerator::VarSize))
+          && reached.insert(methods->Nth(i)).second)
+        changed = true;
+  }
+  return changed;
+}
+
+void Reachability::Run()
+{
+  Position p, prev = code.end();
+  for (p = code.begin(); p != code.end(); prev = p++) {
+    if (VTable *vtable = dynamic_cast<VTable*>(*p))
+      vtables[vtable->GetLabel()] = vtable;
+    else if (dynamic_cast<BeginFunc*>(*p)) {
+      Label *label = (prev != code.end()) ? dynamic_cast<Label*>(*prev) : NULL;
+      Assert(label != NULL);
+      functions[label->text()] = prev;
+    }
+  }
+  if (!functions.count("main")) return;
+
+  reached.insert("main");
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    std::set<std::string>::iterator f;
+    for (f = reached.begin(); f != reached.end(); ++f)
+      if (functions.count(*f) && scanned.insert(*f).second) {
+        Scan(functions[*f]);
+        changed = true;
+      }
+    if (ReachMethods()) changed = true;
+  }
+
+  for (p = code.begin(); p != code.end(); ) {
+    if (VTable *vtable = dynamic_cast<VTable*>(*p)) {
+      if (!classes.count(vtable->GetLabel())) {
+        p = code.erase(p);
+        continue;
+      }
+      List<const char*> *methods = vtable->GetMethodLabels();
+      List<const char*> *kept = new List<const char*>;
+      for (int i = 0; i < methods->NumElements(); i++)
+        kept->Append(reached.count(methods->Nth(i)) ? methods->Nth(i) : NULL);
+      vtable->SetMethodLabels(kept);
+      ++p;
+      continue;
+    }
+    Label *label = dynamic_cast<Label*>(*p);
+    if (!label || !functions.count(label->text()) || functions[label->text()] != p
+        || reached.count(label->text())) {
+      ++p;
+      continue;
+    }
+    while (!dynamic_cast<EndFunc*>(*p)) p = code.erase(p);
+    p = code.erase(p);
+  }
+}
+
+void RemoveUnreachableFunctions(std::list<Instruction*> &code)
+{
+  Reachability pass(code);
+  pass.Run();
+}
@@ -0,0 +1,256 @@
+/* File: regalloc.cc
+ * -----------------
+ * Implementation of the LinearScan register allocator.
+ */
+
+#include "regalloc.h"
+#include "cfg.h"
+#include <algorithm>
+#include <climits>
+#include <list>
+
+
+LinearScan::LinearScan(const std::vector<Instruction*> &fn) : code(fn)
+{
+  Assert(!code.empty() && dynamic_cast<BeginFunc*>(code.front()));
+  NumberVariables();
+  BuildBlocks();
+  ComputeLiveness();
+  BuildIntervals();
+}
+
+// Returns the number of the interval for var, -1 if var is not a
+// candidate for a register.
+int LinearScan::VarNum(Location *var) const
+{
+  std::map<Location*, int>::const_iterator it = varNum.find(var);
+  return it == varNum.end() ? -1 : it->second;
+}
+
+/* Method: NumberVariables
+ * -----------------------
+ * Gives each fp-relative variable mentioned in the function a dense
+ * number used to index the liveness bit vectors and interval table.
+ */
+void LinearScan::NumberVariables()
+{
+  for (int i = 0; i < code.size(); i++) {
+    Instruction *instr = code[i];
+    for (int s = -1; s < instr->NumSrcs(); s++) {
+      Location *var = s < 0 ? instr->GetDst() : instr->GetSrc(s);
+      if (var && var->GetSegment() == fpRelative && !varNum.count(var)) {
+        varNum[var] = intervals.size();
+        Interval interval = {var, INT_MAX, -1, false, -1};
+        intervals.push_back(interval);
+      }
+    }
+    if (dynamic_cast<LCall*>(instr) || dynamic_cast<ACall*>(instr))
+      calls.push_back(i);
+  }
+}
+
+/* Method: BuildBlocks
+ * -------------------
+ * Takes the basic blocks and their successors from the FlowGraph,
+ * recording each block as the range of instruction numbers it spans.
+ */
+void LinearScan::BuildBlocks()
+{
+  FlowGraph graph(code);
+  int next = 0;
+  for (int i = 0; i < graph.blocks.size(); i++) {
+    BasicBlock *bb = graph.blocks[i];
+    Block b;
+    b.first = next;
+    b.last = next + bb->code.size() - 1;
+    next = b.last + 1;
+    for (int s = 0; s < bb->succs.size(); s++)
+      b.succs.push_back(bb->succs[s]->id);
+    blocks.push_back(b);
+  }
+}
+
+/* Method: ComputeLiveness
+ * -----------------------
+ * Classic backwards dataflow: a variable is live on entry to a block
+ * if the block reads it before writing it, or if it is live on exit
+ * and the block doesn't write it. Live on exit is the union of live
+ * on entry of all successors. Iterates until nothing changes.
+ */
+void LinearScan::ComputeLiveness()
+{
+  int numVars = intervals.size();
+  for (int b = 0; b < blocks.size(); b++) {
+    Block &blk = blocks[b];
+    blk.use.assign(numVars, false);
+    blk.def.assign(numVars, false);
+    blk.liveIn.assign(numVars, false);
+    blk.liveOut.assign(numVars, false);
+    for (int i = blk.first; i <= blk.last; i++) {
+      for (int s = 0; s < code[i]->NumSrcs(); s++) {
+        int v = VarNum(code[i]->GetSrc(s));
+        if (v >= 0 && !blk.def[v]) blk.use[v] = true;
+      }
+      int d = VarNum(code[i]->GetDst());
+      if (d >= 0) blk.def[d] = true;
+    }
+  }
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int b = blocks.size() - 1; b >= 0; b--) {
+      Block &blk = blocks[b];
+      for (int v = 0; v < numVars; v++) {
+        bool out = false;
+        for (int s = 0; s < blk.succs.size() && !out; s++)
+          out = blocks[blk.succs[s]].liveIn[v];
+        bool in = blk.use[v] || (out && !blk.def[v]);
+        if (out != blk.liveOut[v] || in != blk.liveIn[v]) {
+          blk.liveOut[v] = out;
+          blk.liveIn[v] = in;
+          changed = true;
+        }
+      }
+    }
+  }
+}
+
+void LinearScan::Extend(int v, int pos)
+{
+  intervals[v].start = std::min(intervals[v].start, pos);
+  intervals[v].end = std::max(intervals[v].end, pos);
+}
+
+/* Method: BuildIntervals
+ * ----------------------
+ * A variable's interval covers every instruction where it is read or
+ * written and the boundaries of every block it is live into or out
+ * of. An interval crosses a call if the variable is live both before
+ * and after the call instruction.
+ */
+void LinearScan::BuildIntervals()
+{
+  for (int b = 0; b < blocks.size(); b++) {
+    Block &blk = blocks[b];
+    for (int v = 0; v < intervals.size(); v++) {
+      if (blk.liveIn[v]) Extend(v, blk.first);
+      if (blk.liveOut[v]) Extend(v, blk.last);
+    }
+    for (int i = blk.first; i <= blk.last; i++) {
+      for (int s = -1; s < code[i]->NumSrcs(); s++) {
+        int v = VarNum(s < 0 ? code[i]->GetDst() : code[i]->GetSrc(s));
+        if (v >= 0) Extend(v, i);
+      }
+    }
+  }
+
+  for (int v = 0; v < intervals.size(); v++) {
+    Interval &interval = intervals[v];
+    std::vector<int>::iterator c =
+      std::upper_bound(calls.begin(), calls.end(), interval.start);
+    interval.crossesCall = (c != calls.end() && *c < interval.end);
+  }
+}
+
+bool LinearScan::IsLiveOnEntry(Location *var) const
+{
+  int v = VarNum(var);
+  return v >= 0 && blocks[0].liveIn[v];
+}
+
+
+/* Method: AssignStackSlots
+ * -------------------------
+ * Interval graph coloring with as many colors as it takes: visiting
+ * intervals by increasing start, each one goes in the first slot whose
+ * last occupant's interval has already ended. Parameters keep the
+ * slots the caller put them in.
+ */
+int LinearScan::AssignStackSlots(int firstOffset)
+{
+  std::vector<std::pair<int,int> > order;    // (start, interval)
+  for (int v = 0; v < intervals.size(); v++)
+    if (intervals[v].reg < 0 && intervals[v].end >= 0
+        && intervals[v].var->GetOffset() < 0)
+      order.push_back(std::make_pair(intervals[v].start, v));
+  std::sort(order.begin(), order.end());
+
+  std::vector<int> slotEnd;                  // end of last interval in slot
+  for (int k = 0; k < order.size(); k++) {
+    Interval &cur = intervals[order[k].second];
+    int slot = 0;
+    while (slot < slotEnd.size() && slotEnd[slot] >= cur.start) slot++;
+    if (slot == slotEnd.size())
+      slotEnd.push_back(cur.end);
+    else
+      slotEnd[slot] = cur.end;
+    cur.var->SetOffset(firstOffset - 4 * slot);
+  }
+  return slotEnd.size();
+}
+
+
+/* Method: Allocate
+ * ----------------
+ * The linear scan proper. The active list holds the intervals that
+ * currently have a register, ordered by increasing end point; an
+ * interval is expired (its register freed) once it ends before the
+ * current one starts. Intervals that don't cross a call prefer the
+ * caller-saved pool so callee-saved registers, which cost a save and
+ * restore in the prologue/epilogue, are only used when needed.
+ */
+void LinearScan::Allocate(const std::vector<int> &callerSaved,
+                          const std::vector<int> &calleeSaved)
+{
+  std::vector<std::pair<int,int> > order;    // (start, interval)
+  for (int v = 0; v < intervals.size(); v++)
+    if (intervals[v].end >= 0)
+      order.push_back(std::make_pair(intervals[v].start, v));
+  std::sort(order.begin(), order.end());
+
+  std::list<int> freeCaller(callerSaved.begin(), callerSaved.end());
+  std::list<int> freeCallee(calleeSaved.begin(), calleeSaved.end());
+  std::list<int> active;
+
+  for (int k = 0; k < order.size(); k++) {
+    Interval &cur = intervals[order[k].second];
+
+    while (!active.empty() && intervals[active.front()].end < cur.start) {
+      int reg = intervals[active.front()].reg;
+      bool isCallee = std::count(calleeSaved.begin(), calleeSaved.end(), reg);
+      (isCallee ? freeCallee : freeCaller).push_back(reg);
+      active.pop_front();
+    }
+
+    if (!cur.crossesCall && !freeCaller.empty()) {
+      cur.reg = freeCaller.front();
+      freeCaller.pop_front();
+    } else if (!freeCallee.empty()) {
+      cur.reg = freeCallee.front();
+      freeCallee.pop_front();
+    } else {
+      // no register free: spill whichever usable interval ends last
+      std::list<int>::iterator victim = active.end();
+      for (std::list<int>::iterator a = active.begin(); a != active.end(); ++a) {
+        bool isCallee = std::count(calleeSaved.begin(), calleeSaved.end(),
+                                   intervals[*a].reg);
+        if (isCallee || !cur.crossesCall)
+          victim = a;
+      }
+      if (victim == active.end() || intervals[*victim].end <= cur.end)
+        continue;                                 // cur stays in memory
+      cur.reg = intervals[*victim].reg;
+      intervals[*victim].reg = -1;
+      active.erase(victim);
+    }
+
+    std::list<int>::iterator pos = active.begin();
+    while (pos != active.end() && intervals[*pos].end <= cur.end) ++pos;
+    active.insert(pos, order[k].second);
+  }
+
+  for (int v = 0; v < intervals.size(); v++)
+    if (intervals[v].reg >= 0)
+      assignment[intervals[v].var] = intervals[v].reg;
+}
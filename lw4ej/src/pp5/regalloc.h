@@ -0,0 +1,92 @@
+/* File: regalloc.h
+ * ----------------
+ * The LinearScan class implements global register allocation by
+ * linear scan (Poletto & Sarkar) over the Tac of a single function.
+ *
+ * The function (the instructions from BeginFunc to EndFunc) is split
+ * into basic blocks and a backwards dataflow pass computes which
+ * variables are live on entry to and exit from each block. From that,
+ * each variable gets one live interval: the range of instruction
+ * numbers from the first to the last point at which it is live.
+ * Intervals are then visited in order of increasing start and handed
+ * a free register; when none is free, whichever interval ends
+ * furthest away stays in memory (is spilled) for its whole lifetime.
+ *
+ * Only fp-relative variables (locals, temps and parameters) are
+ * candidates. Globals can be changed by any function we call, so
+ * they always stay in memory. A variable whose interval spans a call
+ * can only be given a callee-saved register, since the callee (or the
+ * runtime library) is free to trash the others.
+ *
+ * The same intervals are used to lay out the stack frame: locals and
+ * temps left in memory whose intervals don't overlap share a slot.
+ */
+
+#ifndef _H_regalloc
+#define _H_regalloc
+
+#include <map>
+#include <vector>
+#include "tac.h"
+
+
+class LinearScan
+{
+  public:
+    typedef std::map<Location*, int> Assignment;
+
+         // Builds the live intervals for one function. The code
+         // is expected to start with BeginFunc and end with EndFunc.
+    LinearScan(const std::vector<Instruction*> &fn);
+
+         // Hands out registers, given by number. Registers in the
+         // callerSaved pool are clobbered across calls, those in the
+         // calleeSaved pool must be preserved by the function using them.
+    void Allocate(const std::vector<int> &callerSaved,
+                  const std::vector<int> &calleeSaved);
+
+         // After Allocate, maps each variable kept in a register to
+         // that register. Spilled variables are not in the map.
+    const Assignment &GetAssignment() const { return assignment; }
+
+         // True if var may be read before it is written, which for a
+         // parameter means its incoming value must be loaded on entry.
+    bool IsLiveOnEntry(Location *var) const;
+
+         // Moves each local and temp not given a register to a stack
+         // slot, reusing a slot once the interval of the variable in it
+         // has ended. Slots start at firstOffset and go down by 4. Can
+         // be used without Allocate, then all of them are in memory.
+         // Returns the number of slots used.
+    int AssignStackSlots(int firstOffset);
+
+  private:
+    struct Interval {
+      Location *var;
+      int start, end;           // first and last instruction where live
+      bool crossesCall;
+      int reg;                  // -1 if spilled
+    };
+
+    struct Block {
+      int first, last;          // instruction numbers
+      std::vector<int> succs;
+      std::vector<bool> use, def, liveIn, liveOut;
+    };
+
+    std::vector<Instruction*> code;
+    std::map<Location*, int> varNum;
+    std::vector<Interval> intervals;
+    std::vector<Block> blocks;
+    std::vector<int> calls;     // instruction numbers of LCall/ACall
+    Assignment assignment;
+
+    int VarNum(Location *var) const;
+    void NumberVariables();
+    void BuildBlocks();
+    void ComputeLiveness();
+    void BuildIntervals();
+    void Extend(int var, int pos);
+};
+
+#endif
@@ -0,0 +1,215 @@
+/* File: scalars.cc
+ * ----------------
+ * Escape analysis and scalar replacement of objects and arrays, on SSA
+ * form.
+ *
+ * An object (or array) is what an LCall to _Alloc of a constant size
+ * returns, and a pointer to it is that result or one plus a constant.
+ * The object doesn't escape the function when each read of a pointer
+ * to it is the address of a Load or Store at a constant offset inside
+ * it, or the first operand of the Add making another pointer: it isn't
+ * stored anywhere, passed, returned, compared or merged by a phi. Each
+ * read of a pointer in SSA form then sees the object made by the most
+ * recent run of its _Alloc, and nothing can reach the object any other
+ * way.
+ *
+ * When in addition all the Stores into the object are in the block of
+ * its _Alloc, the word at each offset holds, from the last Store to it
+ * on, the value that Store wrote. The Loads from the object, which are
+ * all in blocks that block dominates, then read the variable holding
+ * that value instead, and the Stores and the _Alloc itself go. A Load
+ * of a word no Store wrote yet keeps the object in memory.
+ */
+
+#include "optimize.h"
+#include "codegen.h"
+#include <cstring>
+#include <set>
+
+
+struct Use {
+  Instruction *instr;
+  int src;
+  BasicBlock *block;
+};
+
+static bool IsAlloc(Instruction *instr)
+{
+  LCall *call = dynamic_cast<LCall*>(instr);
+  return call && call->IsBuiltIn() && strcmp(call->GetLabel(), "_Alloc") == 0
+    && SSA::IsRenamed(call->GetDst());
+}
+
+class ScalarReplacement
+{
+  public:
+    ScalarReplacement(FlowGraph *graph);
+    void Run();
+
+  private:
+    FlowGraph *graph;
+    std::map<Location*, Instruction*> definition;
+    std::map<Location*, std::vector<Use> > uses;
+    std::set<Instruction*> deleted;
+    std::map<Location*, Location*> replacement;  // Load result -> value read
+
+    int SizeOf(Instruction *push);
+    bool FindPointers(Location *object, int size, BasicBlock *block,
+                      std::map<Location*, int> &pointers);
+    bool Replace(BasicBlock *block, int at, std::map<Location*, int> &pointers);
+    Location *Resolve(Location *var);
+};
+
+ScalarReplacement::ScalarReplacement(FlowGraph *g) : graph(g) {}
+
+// The size pushed by push if it is a constant, else -1.
+int ScalarReplacement::SizeOf(Instruction *push)
+{
+  if (!dynamic_cast<PushParam*>(push)) return -1;
+  LoadConstant *size = dynamic_cast<LoadConstant*>(definition[push->GetSrc(0)]);
+  return size ? size->GetValue() : -1;
+}
+
+/* Method: FindPointers
+ * --------------------
+ * Escape analysis of the object of the given size whose _Alloc result
+ * is object, in block: gives each pointer to it with its offset from
+ * the start and returns true, or returns false if the object escapes
+ * or is stored into outside block.
+ */
+bool ScalarReplacement::FindPointers(Location *object, int size, BasicBlock *block,
+                                     std::map<Location*, int> &pointers)
+{
+  std::vector<Location*> work(1, object);
+  pointers[object] = 0;
+  while (!work.empty()) {
+    Location *ptr = work.back();
+    work.pop_back();
+    std::vector<Use> &reads = uses[ptr];
+    for (int u = 0; u < reads.size(); u++) {
+      Instruction *instr = reads[u].instr;
+      int offset = pointers[ptr];
+      if (Load *load = dynamic_cast<Load*>(instr))
+        offset += load->GetOffset();
+      else if (Store *store = dynamic_cast<Store*>(instr)) {
+        if (reads[u].src != 0 || reads[u].block != block) return false;
+        offset += store->GetOffset();
+      } else if (BinaryOp *op = dynamic_cast<BinaryOp*>(instr)) {
+        if (op->GetOpCode() != BinaryOp::AddU || !op->HasImmediate()
+            || !SSA::IsRenamed(op->GetDst()) || pointers.count(op->GetDst()))
+          return false;
+        pointers[op->GetDst()] = offset + op->GetImmediate();
+        work.push_back(op->GetDst());
+        continue;
+      } else
+        return false;
+      if (offset < 0 || offset >= size || offset % CodeGenerator::VarSize != 0)
+        return false;
+    }
+  }
+  return true;
+}
+
+/* Method: Replace
+ * ---------------
+ * Plans the replacement of the object whose _Alloc is at index at in
+ * block, with pointers as found by FindPointers: returns false, having
+ * changed nothing, if a Load reads a word before any Store wrote it or
+ * a Store writes a global, which could change before the Loads.
+ */
+bool ScalarReplacement::Replace(BasicBlock *block, int at, std::map<Location*, int> &pointers)
+{
+  std::map<int, Location*> words;               // value at each offset
+  std::map<Location*, Location*> reads;
+  std::vector<Instruction*> gone;
+  std::vector<Instruction*> &code = block->code;
+  for (int i = at + 1; i < code.size(); i++) {
+    if (Store *store = dynamic_cast<Store*>(code[i])) {
+      if (pointers.count(store->GetSrc(0))) {
+        if (!SSA::IsRenamed(store->GetSrc(1))) return false;   // a global may change
+        words[pointers[store->GetSrc(0)] + store->GetOffset()] = store->GetSrc(1);
+        gone.push_back(store);
+      }
+    } else if (Load *load = dynamic_cast<Load*>(code[i])) {
+      if (pointers.count(load->GetSrc(0))) {
+        int offset = pointers[load->GetSrc(0)] + load->GetOffset();
+        if (!words.count(offset)) return false;
+        reads[load->GetDst()] = words[offset];
+        gone.push_back(load);
+      }
+    }
+  }
+
+  std::map<Location*, int>::iterator p;
+  for (p = pointers.begin(); p != pointers.end(); ++p) {
+    std::vector<Use> &ptrUses = uses[p->first];
+    for (int u = 0; u < ptrUses.size(); u++) {
+      Load *load = dynamic_cast<Load*>(ptrUses[u].instr);
+      if (!load || ptrUses[u].block == block) continue;
+      int offset = p->second + load->GetOffset();
+      if (!words.count(offset)) return false;
+      reads[load->GetDst()] = words[offset];
+      gone.push_back(load);
+    }
+  }
+
+  replacement.insert(reads.begin(), reads.end());
+  deleted.insert(gone.begin(), gone.end());
+  deleted.insert(code.begin() + at - 1, code.begin() + at + 2);  // push, _Alloc, pop
+  return true;
+}
+
+Location *ScalarReplacement::Resolve(Location *var)
+{
+  std::map<Location*, Location*>::iterator it;
+  while ((it = replacement.find(var)) != replacement.end())
+    var = it->second;
+  return var;
+}
+
+void ScalarReplacement::Run()
+{
+  std::vector<BasicBlock*> &blocks = graph->blocks;
+  for (int b = 0; b < blocks.size(); b++) {
+    std::vector<Instruction*> &code = blocks[b]->code;
+    for (int i = 0; i < code.size(); i++) {
+      if (SSA::IsRenamed(code[i]->GetDst()))
+        definition[code[i]->GetDst()] = code[i];
+      for (int s = 0; s < code[i]->NumSrcs(); s++) {
+        Use use = { code[i], s, blocks[b] };
+        uses[code[i]->GetSrc(s)].push_back(use);
+      }
+    }
+  }
+
+  for (int b = 0; b < blocks.size(); b++) {
+    std::vector<Instruction*> &code = blocks[b]->code;
+    for (int i = 1; i + 1 < code.size(); i++) {
+      if (!IsAlloc(code[i]) || !dynamic_cast<PopParams*>(code[i + 1])) continue;
+      int size = SizeOf(code[i - 1]);
+      std::map<Location*, int> pointers;
+      if (size > 0 && FindPointers(code[i]->GetDst(), size, blocks[b], pointers))
+        Replace(blocks[b], i, pointers);
+    }
+  }
+  if (deleted.empty()) return;
+
+  for (int b = 0; b < blocks.size(); b++) {
+    std::vector<Instruction*> &code = blocks[b]->code;
+    for (int i = 0; i < code.size(); i++) {
+      if (deleted.count(code[i])) {
+        code.erase(code.begin() + i--);
+        continue;
+      }
+      for (int s = 0; s < code[i]->NumSrcs(); s++)
+        if (replacement.count(code[i]->GetSrc(s)))
+          code[i]->SetSrc(s, Resolve(code[i]->GetSrc(s)));
+    }
+  }
+}
+
+void ReplaceScalars(FlowGraph *graph)
+{
+  ScalarReplacement pass(graph);
+  pass.Run();
+}
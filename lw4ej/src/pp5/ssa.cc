@@ -0,0 +1,446 @@
+/* File: ssa.cc
+ * ------------
+ * Implementation of the SSA class.
+ */
+
+#include "ssa.h"
+#include "codegen.h"
+#include <algorithm>
+#include <cstring>
+#include <set>
+
+
+/* Class: Liveness
+ * ---------------
+ * Numbers the renamed variables of a function densely and finds the
+ * ones live on entry to and exit from each block. A phi reads its
+ * i'th argument at the end of the i'th predecessor, not in its own
+ * block. Each variable's live range is found by walking back from the
+ * blocks that read it before writing it until reaching blocks that
+ * define it.
+ */
+class Liveness
+{
+  public:
+    std::vector<Location*> vars;
+    std::vector<std::vector<int> > defBlocks;       // per variable
+    std::vector<std::vector<int> > liveIn, liveOut;   // per block id
+
+    Liveness(FlowGraph *graph);
+    int Num(Location *var);
+    bool IsLiveIn(BasicBlock *b, int v);
+
+  private:
+    std::map<Location*, int> num;
+    int Add(Location *var);
+};
+
+int Liveness::Num(Location *var)
+{
+  std::map<Location*, int>::iterator it = num.find(var);
+  return it == num.end() ? -1 : it->second;
+}
+
+int Liveness::Add(Location *var)
+{
+  int v = Num(var);
+  if (v < 0) {
+    v = num[var] = vars.size();
+    vars.push_back(var);
+    defBlocks.push_back(std::vector<int>());
+  }
+  return v;
+}
+
+bool Liveness::IsLiveIn(BasicBlock *b, int v)
+{
+  return std::binary_search(liveIn[b->id].begin(), liveIn[b->id].end(), v);
+}
+
+Liveness::Liveness(FlowGraph *graph)
+{
+  int numBlocks = graph->blocks.size();
+  std::vector<std::vector<int> > upwardUses;        // per variable
+  std::vector<std::vector<int> > phiUses;           // preds, per variable
+  std::vector<int> definedIn;                       // per variable
+
+  for (int b = 0; b < numBlocks; b++) {
+    BasicBlock *block = graph->blocks[b];
+    for (int i = 0; i < block->code.size(); i++) {
+      Instruction *instr = block->code[i];
+      bool isPhi = dynamic_cast<Phi*>(instr) != NULL;
+      for (int s = 0; s < instr->NumSrcs(); s++) {
+        if (!SSA::IsRenamed(instr->GetSrc(s))) continue;
+        int v = Add(instr->GetSrc(s));
+        upwardUses.resize(vars.size());
+        phiUses.resize(vars.size());
+        definedIn.resize(vars.size(), -1);
+        if (isPhi)
+          phiUses[v].push_back(block->preds[s]->id);
+        else if (definedIn[v] != b)
+          upwardUses[v].push_back(b);
+      }
+      if (SSA::IsRenamed(instr->GetDst())) {
+        int v = Add(instr->GetDst());
+        upwardUses.resize(vars.size());
+        phiUses.resize(vars.size());
+        definedIn.resize(vars.size(), -1);
+        if (definedIn[v] != b) {
+          definedIn[v] = b;
+          defBlocks[v].push_back(b);
+        }
+      }
+    }
+  }
+
+  liveIn.assign(numBlocks, std::vector<int>());
+  liveOut.assign(numBlocks, std::vector<int>());
+  std::vector<int> defMark(numBlocks, -1), inMark(numBlocks, -1),
+                   outMark(numBlocks, -1);
+  for (int v = 0; v < vars.size(); v++) {
+    for (int i = 0; i < defBlocks[v].size(); i++)
+      defMark[defBlocks[v][i]] = v;
+    std::vector<int> work(upwardUses[v]);
+    for (int i = 0; i < phiUses[v].size(); i++) {
+      int p = phiUses[v][i];
+      if (outMark[p] == v) continue;
+      outMark[p] = v;
+      liveOut[p].push_back(v);
+      if (defMark[p] != v) work.push_back(p);
+    }
+    while (!work.empty()) {
+      int b = work.back();
+      work.pop_back();
+      if (inMark[b] == v) continue;
+      inMark[b] = v;
+      liveIn[b].push_back(v);
+      std::vector<BasicBlock*> &preds = graph->blocks[b]->preds;
+      for (int i = 0; i < preds.size(); i++) {
+        int p = preds[i]->id;
+        if (outMark[p] == v) continue;
+        outMark[p] = v;
+        liveOut[p].push_back(v);
+        if (defMark[p] != v) work.push_back(p);
+      }
+    }
+  }
+}
+
+
+bool SSA::IsRenamed(Location *var)
+{
+  return var != NULL && var->GetSegment() == fpRelative;
+}
+
+Location *SSA::Original(Location *var)
+{
+  std::map<Location*, Location*>::iterator it = original.find(var);
+  return it == original.end() ? var : it->second;
+}
+
+// A version starts out with its original's slot, a parameter's with
+// a local one. Slots are assigned again once registers are allocated.
+Location *SSA::NewVersion(Location *var)
+{
+  Location *orig = Original(var);
+  char *name = new char[strlen(orig->GetName()) + 12];
+  sprintf(name, "%s.%d", orig->GetName(), ++versionCount[orig]);
+  int offset = orig->GetOffset() < 0 ? orig->GetOffset()
+                                     : CodeGenerator::OffsetToFirstLocal;
+  Location *version = new Location(fpRelative, offset, name);
+  delete[] name;
+  original[version] = orig;
+  return version;
+}
+
+SSA::SSA(FlowGraph *g) : graph(g)
+{
+  if (graph->RemoveUnreachableBlocks())
+    graph->Analyze();
+  PlacePhis();
+  std::map<Location*, std::vector<Location*> > stacks;
+  Rename(graph->Entry(), stacks);
+}
+
+// Where phis go: first thing in the block, after its label if any.
+static int PhiPosition(BasicBlock *b)
+{
+  return b->GetLabel() ? 1 : 0;
+}
+
+/* Method: PlacePhis
+ * -----------------
+ * Cytron et al.: a variable defined in block b needs a phi in each
+ * block of b's dominance frontier (the first blocks reached from b
+ * that b doesn't dominate), and as the phi is a new definition, in
+ * each block of that block's frontier and so on. A phi is only placed
+ * where the variable is live (pruned SSA).
+ */
+void SSA::PlacePhis()
+{
+  Liveness live(graph);
+  std::vector<BasicBlock*> &blocks = graph->blocks;
+  for (int b = 0; b < blocks.size(); b++)
+    std::sort(live.liveIn[b].begin(), live.liveIn[b].end());
+
+  std::vector<std::vector<BasicBlock*> > frontier(blocks.size());
+  for (int b = 0; b < blocks.size(); b++) {
+    BasicBlock *join = blocks[b];
+    if (join->preds.size() < 2) continue;
+    for (int p = 0; p < join->preds.size(); p++) {
+      BasicBlock *runner = join->preds[p];
+      if (runner->rpo < 0) continue;
+      for (; runner != join->idom; runner = runner->idom) {
+        std::vector<BasicBlock*> &df = frontier[runner->id];
+        if (df.empty() || df.back() != join)
+          df.push_back(join);
+      }
+    }
+  }
+
+  std::vector<int> hasPhi(blocks.size(), -1), inWork(blocks.size(), -1);
+  for (int v = 0; v < live.vars.size(); v++) {
+    std::vector<BasicBlock*> work;
+    for (int i = 0; i < live.defBlocks[v].size(); i++) {
+      inWork[live.defBlocks[v][i]] = v;
+      work.push_back(blocks[live.defBlocks[v][i]]);
+    }
+    while (!work.empty()) {
+      BasicBlock *b = work.back();
+      work.pop_back();
+      for (int i = 0; i < frontier[b->id].size(); i++) {
+        BasicBlock *f = frontier[b->id][i];
+        if (hasPhi[f->id] == v || !live.IsLiveIn(f, v)) continue;
+        hasPhi[f->id] = v;
+        f->code.insert(f->code.begin() + PhiPosition(f),
+                       new Phi(live.vars[v], f->preds.size()));
+        if (inWork[f->id] != v) {
+          inWork[f->id] = v;
+          work.push_back(f);
+        }
+      }
+    }
+  }
+}
+
+static Location *Current(std::map<Location*, std::vector<Location*> > &stacks,
+                         Location *var)
+{
+  std::map<Location*, std::vector<Location*> >::iterator it = stacks.find(var);
+  return (it == stacks.end() || it->second.empty()) ? var : it->second.back();
+}
+
+/* Method: Rename
+ * --------------
+ * Walks the dominator tree keeping, for each variable, a stack of its
+ * versions whose top is the one reaching the current point. Each read
+ * gets the version on top, each definition pushes a new one, and the
+ * phis of successor blocks get the versions reaching the end of b.
+ * The versions pushed in b are popped when leaving it.
+ */
+void SSA::Rename(BasicBlock *b, std::map<Location*, std::vector<Location*> > &stacks)
+{
+  std::vector<Location*> pushed;
+  for (int i = 0; i < b->code.size(); i++) {
+    Instruction *instr = b->code[i];
+    if (!dynamic_cast<Phi*>(instr))
+      for (int s = 0; s < instr->NumSrcs(); s++)
+        if (IsRenamed(instr->GetSrc(s)))
+          instr->SetSrc(s, Current(stacks, instr->GetSrc(s)));
+    Location *dst = instr->GetDst();
+    if (IsRenamed(dst)) {
+      Location *version = NewVersion(dst);
+      instr->SetDst(version);
+      stacks[dst].push_back(version);
+      pushed.push_back(dst);
+    }
+  }
+
+  for (int s = 0; s < b->succs.size(); s++) {
+    BasicBlock *succ = b->succs[s];
+    int j = std::find(succ->preds.begin(), succ->preds.end(), b) - succ->preds.begin();
+    for (int i = PhiPosition(succ); i < succ->code.size(); i++) {
+      Phi *phi = dynamic_cast<Phi*>(succ->code[i]);
+      if (!phi) break;
+      phi->SetSrc(j, Current(stacks, Original(phi->GetDst())));
+    }
+  }
+
+  for (int c = 0; c < b->domChildren.size(); c++)
+    Rename(b->domChildren[c], stacks);
+  for (int i = 0; i < pushed.size(); i++)
+    stacks[pushed[i]].pop_back();
+}
+
+void SSA::Destroy()
+{
+  InsertCopies();
+  Coalesce();
+}
+
+/* Method: InsertCopies
+ * --------------------
+ * Replaces each "x = phi(a1, .., an)" by "x = x'", with a new variable
+ * x' set by "x' = ai" at the end of the i'th predecessor (before the
+ * branch ending it). As x' is only read at the phi's place, the copy
+ * is harmless on the predecessor's other out edges.
+ */
+void SSA::InsertCopies()
+{
+  std::vector<BasicBlock*> &blocks = graph->blocks;
+  for (int b = 0; b < blocks.size(); b++) {
+    BasicBlock *block = blocks[b];
+    for (int i = PhiPosition(block); i < block->code.size(); i++) {
+      Phi *phi = dynamic_cast<Phi*>(block->code[i]);
+      if (!phi) break;
+      Location *incoming = NewVersion(phi->GetDst());
+      for (int p = 0; p < block->preds.size(); p++) {
+        std::vector<Instruction*> &code = block->preds[p]->code;
+        int pos = (!code.empty() && FlowGraph::EndsBlock(code.back()))
+                  ? code.size() - 1 : code.size();
+        code.insert(code.begin() + pos, new Assign(incoming, phi->GetSrc(p)));
+      }
+      block->code[i] = new Assign(phi->GetDst(), incoming);
+    }
+  }
+}
+
+static bool DeeperCopy(const std::pair<int, Assign*> &a,
+                       const std::pair<int, Assign*> &b)
+{
+  return a.first > b.first;
+}
+
+// Union-find over variable numbers, with for each group the variables
+// it interferes with and the parameter whose incoming value it holds.
+struct Groups
+{
+  std::vector<int> parent;
+  std::vector<std::set<int> > adj;
+  std::vector<Location*> param;
+
+  int Find(int v) {
+    int root = v;
+    while (parent[root] != root) root = parent[root];
+    while (parent[v] != root) { int next = parent[v]; parent[v] = root; v = next; }
+    return root;
+  }
+
+  bool Merge(int a, int b) {
+    a = Find(a); b = Find(b);
+    if (a == b) return true;
+    if (param[a] && param[b]) return false;
+    if (adj[a].size() < adj[b].size()) std::swap(a, b);
+    for (std::set<int>::iterator n = adj[b].begin(); n != adj[b].end(); ++n)
+      if (Find(*n) == a) return false;
+    adj[a].insert(adj[b].begin(), adj[b].end());
+    adj[b].clear();
+    parent[b] = a;
+    if (!param[a]) param[a] = param[b];
+    return true;
+  }
+};
+
+/* Method: Coalesce
+ * ----------------
+ * Builds the interference graph: a variable interferes with every
+ * variable live where it is written, except that a copy's target
+ * doesn't interfere with its source, as both hold the same value.
+ * Variables are then merged along copies, those in the most deeply
+ * nested loops first, and then with the other versions of the same
+ * original, whenever the two groups don't interfere. Two groups that
+ * each hold a parameter's incoming value can't be merged either, as
+ * their values are both there on entry.
+ *
+ * Each group is then stored in one Location: the parameter, or else
+ * the original variable if it is in the group, or else the original
+ * if no other group took it, or else one of its own versions.
+ */
+void SSA::Coalesce()
+{
+  Liveness live(graph);
+  std::vector<BasicBlock*> &blocks = graph->blocks;
+  int numVars = live.vars.size();
+
+  Groups groups;
+  groups.adj.resize(numVars);
+  groups.param.resize(numVars);
+  for (int v = 0; v < numVars; v++) {
+    groups.parent.push_back(v);
+    Location *var = live.vars[v];
+    if (Original(var) == var && var->GetOffset() > 0)
+      groups.param[v] = var;
+  }
+
+  std::vector<std::pair<int, Assign*> > copies;
+  for (int b = 0; b < blocks.size(); b++) {
+    std::set<int> liveNow(live.liveOut[b].begin(), live.liveOut[b].end());
+    std::vector<Instruction*> &code = blocks[b]->code;
+    for (int i = code.size() - 1; i >= 0; i--) {
+      Instruction *instr = code[i];
+      int d = live.Num(instr->GetDst());
+      if (d >= 0) {
+        Assign *copy = dynamic_cast<Assign*>(instr);
+        int src = copy ? live.Num(copy->GetSrc(0)) : -1;
+        if (src >= 0)
+          copies.push_back(std::make_pair(blocks[b]->LoopDepth(), copy));
+        for (std::set<int>::iterator l = liveNow.begin(); l != liveNow.end(); ++l)
+          if (*l != d && *l != src) {
+            groups.adj[d].insert(*l);
+            groups.adj[*l].insert(d);
+          }
+        liveNow.erase(d);
+      }
+      for (int s = 0; s < instr->NumSrcs(); s++) {
+        int v = live.Num(instr->GetSrc(s));
+        if (v >= 0) liveNow.insert(v);
+      }
+    }
+  }
+
+  std::stable_sort(copies.begin(), copies.end(), DeeperCopy);
+  for (int i = 0; i < copies.size(); i++)
+    groups.Merge(live.Num(copies[i].second->GetDst()),
+                 live.Num(copies[i].second->GetSrc(0)));
+  std::map<Location*, int> firstVersion;
+  for (int v = 0; v < numVars; v++) {
+    Location *orig = Original(live.vars[v]);
+    if (firstVersion.count(orig))
+      groups.Merge(firstVersion[orig], v);
+    else
+      firstVersion[orig] = v;
+  }
+
+  std::vector<Location*> storage(numVars, (Location*)NULL);
+  std::set<Location*> taken;
+  for (int v = 0; v < numVars; v++) {
+    int g = groups.Find(v);
+    if (groups.param[g])
+      storage[g] = groups.param[g];
+    else if (Original(live.vars[v]) == live.vars[v] && !storage[g])
+      storage[g] = live.vars[v];
+    if (storage[g]) taken.insert(storage[g]);
+  }
+  for (int v = 0; v < numVars; v++) {
+    int g = groups.Find(v);
+    if (storage[g]) continue;
+    Location *orig = Original(live.vars[v]);
+    storage[g] = (orig->GetOffset() < 0 && !taken.count(orig)) ? orig : live.vars[v];
+    taken.insert(storage[g]);
+  }
+
+  for (int b = 0; b < blocks.size(); b++) {
+    std::vector<Instruction*> &code = blocks[b]->code;
+    for (int i = 0; i < code.size(); i++) {
+      Instruction *instr = code[i];
+      for (int s = 0; s < instr->NumSrcs(); s++) {
+        int v = live.Num(instr->GetSrc(s));
+        if (v >= 0) instr->SetSrc(s, storage[groups.Find(v)]);
+      }
+      int d = live.Num(instr->GetDst());
+      if (d >= 0) instr->SetDst(storage[groups.Find(d)]);
+      if (dynamic_cast<Assign*>(instr) && instr->GetDst() == instr->GetSrc(0))
+        code.erase(code.begin() + i--);
+    }
+  }
+}
@@ -0,0 +1,68 @@
+/* File: ssa.h
+ * -----------
+ * The SSA class puts the Tac of one function (held in a FlowGraph)
+ * into static single assignment form and takes it back out, so that
+ * passes in between can treat every variable as having exactly one
+ * definition.
+ *
+ * Only fp-relative variables (locals, temps and parameters) are
+ * renamed; globals can be changed behind our back by any call. Each
+ * definition of a variable x makes a new version, a Location named
+ * x.1, x.2, ...; the value x has on entry to the function (what the
+ * caller passed for a parameter, garbage for a local) keeps the name
+ * and Location x itself. Phis are placed at the iterated dominance
+ * frontier of the blocks defining x, but only where x is live.
+ *
+ * Destroy replaces each phi by a copy into a fresh variable at the end
+ * of every predecessor and a copy out of it where the phi was (Sreedhar
+ * et al., method I), which is correct without splitting any edges.
+ * Variables are then merged along copies, and with the other versions
+ * of their original, wherever they don't interfere. Most copies, and
+ * in unoptimized code all of them, disappear; what is left of each
+ * merged group is stored in one Location, the original's if possible.
+ *
+ * Liveness is computed one variable at a time by walking back from
+ * its uses, which costs time in proportion to the size of the live
+ * ranges instead of blocks times variables.
+ */
+
+#ifndef _H_ssa
+#define _H_ssa
+
+#include <map>
+#include <vector>
+#include "cfg.h"
+
+
+class SSA
+{
+  public:
+         // Puts the function in graph in SSA form. Unreachable blocks
+         // are removed first since renaming never visits them.
+    SSA(FlowGraph *graph);
+
+         // Goes back to normal form, leaving no Phi in the graph.
+    void Destroy();
+
+         // True for the variables that are renamed.
+    static bool IsRenamed(Location *var);
+
+         // The variable that var is a version of, var itself for a
+         // variable that isn't a version.
+    Location *Original(Location *var);
+
+         // Makes a new version of var's original.
+    Location *NewVersion(Location *var);
+
+  private:
+    FlowGraph *graph;
+    std::map<Location*, Location*> original;
+    std::map<Location*, int> versionCount;
+
+    void PlacePhis();
+    void Rename(BasicBlock *b, std::map<Location*, std::vector<Location*> > &stacks);
+    void InsertCopies();
+    void Coalesce();
+};
+
+#endif
@@ -25,6 +25,9 @@ void Instruction::Emit(Mips *mips) {
 LoadConstant::LoadConstant(Location *d, int v)
   : dst(d), val(v) {
   Assert(dst != NULL);
+  Reprint();
+}
+void LoadConstant::Reprint() {
   sprintf(printed, "%s = %d", dst->GetName(), val);
 }
 void LoadConstant::EmitSpecific(Mips *mips) {
@@ -37,7 +40,10 @@ LoadStringConstant::LoadStringConstant(Location *d, const char *s)
   const char *quote = (*s == '"') ? "" : "\"";
   str = new char[strlen(s) + 2*strlen(quote) + 1];
   sprintf(str, "%s%s%s", quote, s, quote);
-  quote = (strlen(str) > 50) ? "...\"" : "";
+  Reprint();
+}
+void LoadStringConstant::Reprint() {
+  const char *quote = (strlen(str) > 50) ? "...\"" : "";
   sprintf(printed, "%s = %.50s%s", dst->GetName(), str, quote);
 }
 void LoadStringConstant::EmitSpecific(Mips *mips) {
@@ -47,6 +53,9 @@ void LoadStringConstant::EmitSpecific(Mips *mips) {
 LoadLabel::LoadLabel(Location *d, const char *l)
   : dst(d), label(strdup(l)) {
   Assert(dst != NULL && label != NULL);
+  Reprint();
+}
+void LoadLabel::Reprint() {
   sprintf(printed, "%s = %s", dst->GetName(), label);
 }
 void LoadLabel::EmitSpecific(Mips *mips) {
@@ -56,6 +65,9 @@ void LoadLabel::EmitSpecific(Mips *mips) {
 Assign::Assign(Location *d, Location *s)
   : dst(d), src(s) {
   Assert(dst != NULL && src != NULL);
+  Reprint();
+}
+void Assign::Reprint() {
   sprintf(printed, "%s = %s", dst->GetName(), src->GetName());
 }
 void Assign::EmitSpecific(Mips *mips) {
@@ -63,8 +75,11 @@ void Assign::EmitSpecific(Mips *mips) {
 }
 
 Load::Load(Location *d, Location *s, int off)
-  : dst(d), src(s), offset(off) {
+  : dst(d), src(s), offset(off), checksNull(false) {
   Assert(dst != NULL && src != NULL);
+  Reprint();
+}
+void Load::Reprint() {
   if (offset) 
     sprintf(printed, "%s = *(%s + %d)", dst->GetName(), src->GetName(), offset);
   else
@@ -77,6 +92,9 @@ void Load::EmitSpecific(Mips *mips) {
 Store::Store(Location *d, Location *s, int off)
   : dst(d), src(s), offset(off) {
   Assert(dst != NULL && src != NULL);
+  Reprint();
+}
+void Store::Reprint() {
   if (offset)
     sprintf(printed, "*(%s + %d) = %s", dst->GetName(), offset, src->GetName());
   else
@@ -86,7 +104,7 @@ void Store::EmitSpecific(Mips *mips) {
   mips->EmitStore(dst, src, offset);
 }
  
-const char * const BinaryOp::opName[BinaryOp::NumOps]  = {"+", "-", "*", "/", "%", "==", "<", "&&", "||"};;
+const char * const BinaryOp::opName[BinaryOp::NumOps]  = {"+", "-", "*", "/", "%", "==", "<", "&&", "||", "<<", ">>", ">>>", "*hi", "+u"};;
 
 BinaryOp::OpCode BinaryOp::OpCodeForName(const char *name) {
   for (int i = 0; i < NumOps; i++) 
@@ -97,13 +115,28 @@ BinaryOp::OpCode BinaryOp::OpCodeForName(const char *name) {
 }
 
 BinaryOp::BinaryOp(OpCode c, Location *d, Location *o1, Location *o2)
-  : code(c), dst(d), op1(o1), op2(o2) {
+  : code(c), dst(d), op1(o1), op2(o2), imm(0) {
   Assert(dst != NULL && op1 != NULL && op2 != NULL);
   Assert(code >= 0 && code < NumOps);
-  sprintf(printed, "%s = %s %s %s", dst->GetName(), op1->GetName(), opName[code], op2->GetName());
+  Reprint();
+}
+BinaryOp::BinaryOp(OpCode c, Location *d, Location *o1, int i)
+  : code(c), dst(d), op1(o1), op2(NULL), imm(i) {
+  Assert(dst != NULL && op1 != NULL);
+  Assert(code >= 0 && code < NumOps);
+  Reprint();
+}
+void BinaryOp::Reprint() {
+  if (op2)
+    sprintf(printed, "%s = %s %s %s", dst->GetName(), op1->GetName(), opName[code], op2->GetName());
+  else
+    sprintf(printed, "%s = %s %s %d", dst->GetName(), op1->GetName(), opName[code], imm);
 }
 void BinaryOp::EmitSpecific(Mips *mips) {	  
-  mips->EmitBinaryOp(code, dst, op1, op2);
+  if (op2)
+    mips->EmitBinaryOp(code, dst, op1, op2);
+  else
+    mips->EmitBinaryOp(code, dst, op1, imm);
 }
 
 Label::Label(const char *l) : label(strdup(l)) {
@@ -120,6 +153,13 @@ void Label::EmitSpecific(Mips *mips) {
  
 Goto::Goto(const char *l) : label(strdup(l)) {
   Assert(label != NULL);
+  Reprint();
+}
+void Goto::SetLabel(const char *l) {
+  label = strdup(l);
+  Reprint();
+}
+void Goto::Reprint() {
   sprintf(printed, "Goto %s", label);
 }
 void Goto::EmitSpecific(Mips *mips) {	  
@@ -129,12 +169,105 @@ void Goto::EmitSpecific(Mips *mips) {
 IfZ::IfZ(Location *te, const char *l)
    : test(te), label(strdup(l)) {
   Assert(test != NULL && label != NULL);
+  Reprint();
+}
+void IfZ::SetLabel(const char *l) {
+  label = strdup(l);
+  Reprint();
+}
+void IfZ::Reprint() {
   sprintf(printed, "IfZ %s Goto %s", test->GetName(), label);
 }
 void IfZ::EmitSpecific(Mips *mips) {	  
   mips->EmitIfZ(test, label);
 }
 
+const char * const IfCmp::relName[IfCmp::NumRelations] = {"==", "!=", "<", "<=", ">", ">="};
+
+IfCmp::Relation IfCmp::RelationForName(const char *name) {
+  for (int i = 0; i < NumRelations; i++)
+    if (!strcmp(relName[i], name))
+      return (Relation)i;
+  Failure("Unrecognized relation: '%s'\n", name);
+  return Eq;
+}
+
+IfCmp::Relation IfCmp::Negate(Relation rel) {
+  static const Relation negated[NumRelations] =
+    {Ne, Eq, GreaterEq, Greater, LessEq, Less};
+  return negated[rel];
+}
+
+IfCmp::Relation IfCmp::Reverse(Relation rel) {
+  static const Relation reversed[NumRelations] =
+    {Eq, Ne, Greater, GreaterEq, Less, LessEq};
+  return reversed[rel];
+}
+
+bool IfCmp::Holds(Relation rel, int a, int b) {
+  switch (rel) {
+    case Eq:        return a == b;
+    case Ne:        return a != b;
+    case Less:      return a < b;
+    case LessEq:    return a <= b;
+    case Greater:   return a > b;
+    case GreaterEq: return a >= b;
+    default:        return false;
+  }
+}
+
+IfCmp::IfCmp(Relation r, Location *o1, Location *o2, const char *l)
+  : rel(r), op1(o1), op2(o2), imm(0), label(strdup(l)) {
+  Assert(op1 != NULL && op2 != NULL && label != NULL);
+  Reprint();
+}
+IfCmp::IfCmp(Relation r, Location *o1, int i, const char *l)
+  : rel(r), op1(o1), op2(NULL), imm(i), label(strdup(l)) {
+  Assert(op1 != NULL && label != NULL);
+  Reprint();
+}
+void IfCmp::SetLabel(const char *l) {
+  label = strdup(l);
+  Reprint();
+}
+void IfCmp::Reprint() {
+  if (op2)
+    sprintf(printed, "If %s %s %s Goto %s", op1->GetName(), relName[rel],
+            op2->GetName(), label);
+  else
+    sprintf(printed, "If %s %s %d Goto %s", op1->GetName(), relName[rel],
+            imm, label);
+}
+void IfCmp::EmitSpecific(Mips *mips) {
+  if (op2)
+    mips->EmitIfCmp(rel, op1, op2, label);
+  else
+    mips->EmitIfCmp(rel, op1, imm, label);
+}
+
+BoundsCheck::BoundsCheck(Location *i, Location *len)
+  : index(i), length(len) {
+  Assert(index != NULL && length != NULL);
+  Reprint();
+}
+void BoundsCheck::Reprint() {
+  sprintf(printed, "BoundsCheck %s < %s", index->GetName(), length->GetName());
+}
+void BoundsCheck::EmitSpecific(Mips *mips) {
+  mips->EmitBoundsCheck(index, length);
+}
+
+SizeCheck::SizeCheck(Location *s) : size(s) {
+  Assert(size != NULL);
+  Reprint();
+}
+void SizeCheck::Reprint() {
+  sprintf(printed, "SizeCheck %s >= 0", size->GetName());
+}
+void SizeCheck::EmitSpecific(Mips *mips) {
+  mips->EmitSizeCheck(size);
+}
+
 BeginFunc::BeginFunc() {
   sprintf(printed,"BeginFunc (unassigned)");
   frameSize = -555; // used as sentinel to recognized unassigned value
@@ -156,6 +289,9 @@ void EndFunc::EmitSpecific(Mips *mips) {
 }
  
 Return::Return(Location *v) : val(v) {
+  Reprint();
+}
+void Return::Reprint() {
   sprintf(printed, "Return %s", val? val->GetName() : "");
 }
 void Return::EmitSpecific(Mips *mips) {	  
@@ -165,6 +301,9 @@ void Return::EmitSpecific(Mips *mips) {
 PushParam::PushParam(Location *p)
   :  param(p) {
   Assert(param != NULL);
+  Reprint();
+}
+void PushParam::Reprint() {
   sprintf(printed, "PushParam %s", param->GetName());
 }
 void PushParam::EmitSpecific(Mips *mips) {
@@ -180,17 +319,23 @@ void PopParams::EmitSpecific(Mips *mips) {
 } 
 
 
-LCall::LCall(const char *l, Location *d)
-  :  label(strdup(l)), dst(d) {
+LCall::LCall(const char *l, Location *d, bool b)
+  :  label(strdup(l)), dst(d), isBuiltIn(b) {
+  Reprint();
+}
+void LCall::Reprint() {
   sprintf(printed, "%s%sLCall %s", dst? dst->GetName(): "", dst?" = ":"", label);
 }
 void LCall::EmitSpecific(Mips *mips) {
-  mips->EmitLCall(dst, label);
+  mips->EmitLCall(dst, label, isBuiltIn);
 }
 
 ACall::ACall(Location *ma, Location *d)
   : dst(d), methodAddr(ma) {
   Assert(methodAddr != NULL);
+  Reprint();
+}
+void ACall::Reprint() {
   sprintf(printed, "%s%sACall %s", dst? dst->GetName(): "", dst?" = ":"",
 	    methodAddr->GetName());
 }
@@ -198,6 +343,28 @@ void ACall::EmitSpecific(Mips *mips) {
   mips->EmitACall(dst, methodAddr);
 } 
 
+Phi::Phi(Location *d, int n)
+  : dst(d), args(n, d) {
+  Assert(dst != NULL && n > 0);
+  Reprint();
+}
+void Phi::SetSrcs(const std::vector<Location*> &srcs) {
+  Assert(!srcs.empty());
+  args = srcs;
+  Reprint();
+}
+void Phi::Reprint() {
+  int n = snprintf(printed, sizeof(printed), "%s = phi(", dst->GetName());
+  for (int i = 0; i < args.size() && n < sizeof(printed); i++)
+    n += snprintf(printed + n, sizeof(printed) - n, "%s%s", i ? ", " : "",
+                  args[i]->GetName());
+  if (n < sizeof(printed))
+    snprintf(printed + n, sizeof(printed) - n, ")");
+}
+void Phi::EmitSpecific(Mips *mips) {
+  Failure("Phi for %s left in code to be emitted", dst->GetName());
+}
+
 VTable::VTable(const char *l, List<const char *> *m)
   : methodLabels(m), label(strdup(l)) {
   Assert(methodLabels != NULL && label != NULL);
@@ -207,7 +374,7 @@ VTable::VTable(const char *l, List<const char *> *m)
 void VTable::Print() {
   printf("VTable %s =\n", label);
   for (int i = 0; i < methodLabels->NumElements(); i++) 
-    printf("\t%s,\n", methodLabels->Nth(i));
+    printf("\t%s,\n", methodLabels->Nth(i) ? methodLabels->Nth(i) : "0");
   printf("; \n"); 
 }
 void VTable::EmitSpecific(Mips *mips) {
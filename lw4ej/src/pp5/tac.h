@@ -23,6 +23,7 @@
 #ifndef _H_tac
 #define _H_tac
 
+#include <vector>
 #include "list.h" // for VTable
 class Mips;
 
@@ -52,6 +53,8 @@ class Location
     Segment GetSegment() const      { return segment; }
     int GetOffset() const           { return offset; }
     Location* GetBase() const       { return base; }
+
+    void SetOffset(int off)         { offset = off; }
 };
  
 
@@ -67,6 +70,22 @@ class Instruction {
 	virtual void Print();
 	virtual void EmitSpecific(Mips *mips) = 0;
 	void Emit(Mips *mips);
+
+	// operand access for the passes that analyze Tac (e.g. register
+	// allocation). GetDst is the variable written (NULL if none),
+	// GetSrc(0) .. GetSrc(NumSrcs()-1) are the variables read.
+	virtual Location *GetDst()      { return NULL; }
+	virtual int NumSrcs()           { return 0; }
+	virtual Location *GetSrc(int i) { return NULL; }
+
+	// operand replacement for the passes that rewrite Tac (e.g. SSA
+	// renaming): SetDst/SetSrc change the variable that GetDst/GetSrc
+	// return. Only valid for an instruction that has that operand.
+	virtual void SetDst(Location *var)        { Assert(0); }
+	virtual void SetSrc(int i, Location *var) { Assert(0); }
+
+    protected:
+	virtual void Reprint() {}    // refreshes printed from the operands
 };
 
   
@@ -84,6 +103,7 @@ class Instruction {
   class Label;
   class Goto;
   class IfZ;
+  class IfCmp;
   class BeginFunc;
   class EndFunc;
   class Return;
@@ -92,6 +112,9 @@ class Instruction {
   class LCall;
   class ACall;
   class VTable;
+  class Phi;
+  class BoundsCheck;
+  class SizeCheck;
 
 
 
@@ -101,6 +124,11 @@ class LoadConstant: public Instruction {
   public:
     LoadConstant(Location *dst, int val);
     void EmitSpecific(Mips *mips);
+    Location *GetDst() { return dst; }
+    void SetDst(Location *var) { dst = var; Reprint(); }
+    int GetValue() { return val; }
+  protected:
+    void Reprint();
 };
 
 class LoadStringConstant: public Instruction {
@@ -109,6 +137,10 @@ class LoadStringConstant: public Instruction {
   public:
     LoadStringConstant(Location *dst, const char *s);
     void EmitSpecific(Mips *mips);
+    Location *GetDst() { return dst; }
+    void SetDst(Location *var) { dst = var; Reprint(); }
+  protected:
+    void Reprint();
 };
     
 class LoadLabel: public Instruction {
@@ -117,6 +149,11 @@ class LoadLabel: public Instruction {
   public:
     LoadLabel(Location *dst, const char *label);
     void EmitSpecific(Mips *mips);
+    Location *GetDst() { return dst; }
+    void SetDst(Location *var) { dst = var; Reprint(); }
+    const char *GetLabel() { return label; }
+  protected:
+    void Reprint();
 };
 
 class Assign: public Instruction {
@@ -124,14 +161,33 @@ class Assign: public Instruction {
   public:
     Assign(Location *dst, Location *src);
     void EmitSpecific(Mips *mips);
+    Location *GetDst() { return dst; }
+    int NumSrcs() { return 1; }
+    Location *GetSrc(int i) { return src; }
+    void SetDst(Location *var) { dst = var; Reprint(); }
+    void SetSrc(int i, Location *var) { src = var; Reprint(); }
+  protected:
+    void Reprint();
 };
 
 class Load: public Instruction {
     Location *dst, *src;
     int offset;
+    bool checksNull;    // kept for faulting on null even if unused
   public:
     Load(Location *dst, Location *src, int offset = 0);
     void EmitSpecific(Mips *mips);
+    Location *GetDst() { return dst; }
+    int NumSrcs() { return 1; }
+    Location *GetSrc(int i) { return src; }
+    void SetDst(Location *var) { dst = var; Reprint(); }
+    void SetSrc(int i, Location *var) { src = var; Reprint(); }
+    int GetOffset() { return offset; }
+    void SetOffset(int off) { offset = off; Reprint(); }
+    bool ChecksNull() { return checksNull; }
+    void SetChecksNull() { checksNull = true; }
+  protected:
+    void Reprint();
 };
 
 class Store: public Instruction {
@@ -140,21 +196,46 @@ class Store: public Instruction {
   public:
     Store(Location *d, Location *s, int offset = 0);
     void EmitSpecific(Mips *mips);
+    int NumSrcs() { return 2; }   // both the address and the value are read
+    Location *GetSrc(int i) { return i == 0 ? dst : src; }
+    void SetSrc(int i, Location *var) { (i == 0 ? dst : src) = var; Reprint(); }
+    int GetOffset() { return offset; }
+    void SetOffset(int off) { offset = off; Reprint(); }
+  protected:
+    void Reprint();
 };
 
 class BinaryOp: public Instruction {
 
   public:
-    typedef enum {Add, Sub, Mul, Div, Mod, Eq, Less, And, Or, NumOps} OpCode;
+    // Shl, Shr (arithmetic), ShrU (logical) and MulHi (high word of
+    // the 64-bit product) have no Decaf operator, they are only made
+    // by the code generator's strength reduction; AddU (an add that
+    // wraps around instead of trapping) only by the optimizer, for
+    // addresses
+    typedef enum {Add, Sub, Mul, Div, Mod, Eq, Less, And, Or,
+                  Shl, Shr, ShrU, MulHi, AddU, NumOps} OpCode;
     static const char * const opName[NumOps];
     static OpCode OpCodeForName(const char *name);
     
   protected:
     OpCode code;
     Location *dst, *op1, *op2;
+    int imm;                    // second operand when op2 is NULL
   public:
     BinaryOp(OpCode c, Location *dst, Location *op1, Location *op2);
+    BinaryOp(OpCode c, Location *dst, Location *op1, int imm);
     void EmitSpecific(Mips *mips);
+    Location *GetDst() { return dst; }
+    int NumSrcs() { return op2 ? 2 : 1; }
+    Location *GetSrc(int i) { return i == 0 ? op1 : op2; }
+    void SetDst(Location *var) { dst = var; Reprint(); }
+    void SetSrc(int i, Location *var) { (i == 0 ? op1 : op2) = var; Reprint(); }
+    OpCode GetOpCode() { return code; }
+    bool HasImmediate() { return op2 == NULL; }
+    int GetImmediate() { return imm; }
+  protected:
+    void Reprint();
 };
 
 class Label: public Instruction {
@@ -172,6 +253,9 @@ class Goto: public Instruction {
     Goto(const char *label);
     void EmitSpecific(Mips *mips);
     const char* branch_label() const { return label; }
+    void SetLabel(const char *l);
+  protected:
+    void Reprint();
 };
 
 class IfZ: public Instruction {
@@ -180,7 +264,75 @@ class IfZ: public Instruction {
   public:
     IfZ(Location *test, const char *label);
     void EmitSpecific(Mips *mips);
+    int NumSrcs() { return 1; }
+    Location *GetSrc(int i) { return test; }
+    void SetSrc(int i, Location *var) { test = var; Reprint(); }
+    const char* branch_label() const { return label; }
+    void SetLabel(const char *l);
+  protected:
+    void Reprint();
+};
+
+// Branches to label if "op1 rel op2" holds. The second operand is
+// either a variable or, when op2 is NULL, the constant imm.
+class IfCmp: public Instruction {
+  public:
+    typedef enum {Eq, Ne, Less, LessEq, Greater, GreaterEq,
+                  NumRelations} Relation;
+    static const char * const relName[NumRelations];
+    static Relation RelationForName(const char *name);
+    static Relation Negate(Relation rel);       // !(a rel b)
+    static Relation Reverse(Relation rel);      // b rel' a
+    static bool Holds(Relation rel, int a, int b);
+
+  protected:
+    Relation rel;
+    Location *op1, *op2;
+    int imm;
+    const char *label;
+  public:
+    IfCmp(Relation rel, Location *op1, Location *op2, const char *label);
+    IfCmp(Relation rel, Location *op1, int imm, const char *label);
+    void EmitSpecific(Mips *mips);
+    int NumSrcs() { return op2 ? 2 : 1; }
+    Location *GetSrc(int i) { return i == 0 ? op1 : op2; }
+    void SetSrc(int i, Location *var) { (i == 0 ? op1 : op2) = var; Reprint(); }
     const char* branch_label() const { return label; }
+    void SetLabel(const char *l);
+    Relation GetRelation() { return rel; }
+    bool HasImmediate() { return op2 == NULL; }
+    int GetImmediate() { return imm; }
+  protected:
+    void Reprint();
+};
+
+// Stops the program with the subscript error unless 0 <= index <
+// length. The code for the error is shared by the function's checks,
+// so a check is one branch off to it and the check doesn't end a block.
+class BoundsCheck: public Instruction {
+    Location *index, *length;
+  public:
+    BoundsCheck(Location *index, Location *length);
+    void EmitSpecific(Mips *mips);
+    int NumSrcs() { return 2; }
+    Location *GetSrc(int i) { return i == 0 ? index : length; }
+    void SetSrc(int i, Location *var) { (i == 0 ? index : length) = var; Reprint(); }
+  protected:
+    void Reprint();
+};
+
+// Stops the program with the array size error if size < 0, in the same
+// way.
+class SizeCheck: public Instruction {
+    Location *size;
+  public:
+    SizeCheck(Location *size);
+    void EmitSpecific(Mips *mips);
+    int NumSrcs() { return 1; }
+    Location *GetSrc(int i) { return size; }
+    void SetSrc(int i, Location *var) { size = var; Reprint(); }
+  protected:
+    void Reprint();
 };
 
 class BeginFunc: public Instruction {
@@ -189,6 +341,7 @@ class BeginFunc: public Instruction {
     BeginFunc();
     // used to backpatch the instruction with frame size once known
     void SetFrameSize(int numBytesForAllLocalsAndTemps);
+    int GetFrameSize() { return frameSize; }
     void EmitSpecific(Mips *mips);
 };
 
@@ -203,6 +356,11 @@ class Return: public Instruction {
   public:
     Return(Location *val);
     void EmitSpecific(Mips *mips);
+    int NumSrcs() { return val ? 1 : 0; }
+    Location *GetSrc(int i) { return val; }
+    void SetSrc(int i, Location *var) { val = var; Reprint(); }
+  protected:
+    void Reprint();
 };   
 
 class PushParam: public Instruction {
@@ -210,6 +368,11 @@ class PushParam: public Instruction {
   public:
     PushParam(Location *param);
     void EmitSpecific(Mips *mips);
+    int NumSrcs() { return 1; }
+    Location *GetSrc(int i) { return param; }
+    void SetSrc(int i, Location *var) { param = var; Reprint(); }
+  protected:
+    void Reprint();
 }; 
 
 class PopParams: public Instruction {
@@ -217,14 +380,22 @@ class PopParams: public Instruction {
   public:
     PopParams(int numBytesOfParamsToRemove);
     void EmitSpecific(Mips *mips);
+    int GetBytes() { return numBytes; }
 }; 
 
 class LCall: public Instruction {
     const char *label;
     Location *dst;
+    bool isBuiltIn;   // runtime library routines take their args on the stack
   public:
-    LCall(const char *labe, Location *result);
+    LCall(const char *labe, Location *result, bool isBuiltIn = false);
     void EmitSpecific(Mips *mips);
+    Location *GetDst() { return dst; }
+    void SetDst(Location *var) { dst = var; Reprint(); }
+    const char *GetLabel() { return label; }
+    bool IsBuiltIn() { return isBuiltIn; }
+  protected:
+    void Reprint();
 };
 
 class ACall: public Instruction {
@@ -232,6 +403,32 @@ class ACall: public Instruction {
   public:
     ACall(Location *meth, Location *result);
     void EmitSpecific(Mips *mips);
+    Location *GetDst() { return dst; }
+    int NumSrcs() { return 1; }
+    Location *GetSrc(int i) { return methodAddr; }
+    void SetDst(Location *var) { dst = var; Reprint(); }
+    void SetSrc(int i, Location *var) { methodAddr = var; Reprint(); }
+  protected:
+    void Reprint();
+};
+
+// Only exists while a function is in SSA form (see ssa.h): at the top
+// of a block, dst gets args[i] when control comes from the block's
+// i'th predecessor. It is replaced by copies before code generation.
+class Phi: public Instruction {
+    Location *dst;
+    std::vector<Location*> args;
+  public:
+    Phi(Location *dst, int numArgs);
+    void EmitSpecific(Mips *mips);
+    Location *GetDst() { return dst; }
+    int NumSrcs() { return args.size(); }
+    Location *GetSrc(int i) { return args[i]; }
+    void SetDst(Location *var) { dst = var; Reprint(); }
+    void SetSrc(int i, Location *var) { args[i] = var; Reprint(); }
+    void SetSrcs(const std::vector<Location*> &srcs);
+  protected:
+    void Reprint();
 };
 
 class VTable: public Instruction {
@@ -239,6 +436,9 @@ class VTable: public Instruction {
     const char *label;
  public:
     VTable(const char *labelForTable, List<const char *> *methodLabels);
+    const char *GetLabel() { return label; }
+    List<const char *> *GetMethodLabels() { return methodLabels; }
+    void SetMethodLabels(List<const char *> *m) { methodLabels = m; } // NULL for an empty slot
     void Print();
     void EmitSpecific(Mips *mips);
 };
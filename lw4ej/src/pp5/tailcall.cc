@@ -0,0 +1,124 @@
+/* File: tailcall.cc
+ * -----------------
+ * Self tail call elimination, on the Tac of the whole program before
+ * calls are inlined.
+ *
+ * A call is in tail position when what follows it, past its PopParams
+ * and any labels, is a Return of its result (or a Return without one,
+ * or the function's end, for a call without a result). When such a call
+ * is to the function itself, its PushParams, the LCall and the
+ * PopParams are replaced by assigning each argument to the parameter
+ * it is for and jumping back to the start of the body, so that the
+ * recursion runs as a loop in a single frame. An argument that is
+ * itself another parameter is first copied to a new variable, since
+ * the parameters are assigned one after the other.
+ *
+ * A method calling itself is an LCall once it is devirtualized, with
+ * "this" as its first argument, and is handled the same way.
+ */
+
+#include "optimize.h"
+#include "codegen.h"
+#include <cstring>
+
+typedef std::list<Instruction*>::iterator Position;
+
+// A new local of the function starting at begin, in a slot below its
+// other locals and temps.
+static Location *NewVariable(BeginFunc *begin, const char *name)
+{
+  int frameSize = begin->GetFrameSize();
+  begin->SetFrameSize(frameSize + CodeGenerator::VarSize);
+  return new Location(fpRelative, CodeGenerator::OffsetToFirstLocal - frameSize, name);
+}
+
+static bool IsParameter(Location *var)
+{
+  return var && var->GetSegment() == fpRelative && var->GetOffset() > 0;
+}
+
+// True if call, followed by the instruction at next, is in tail position.
+static bool InTailPosition(LCall *call, Position next)
+{
+  if (dynamic_cast<PopParams*>(*next)) ++next;
+  while (dynamic_cast<Label*>(*next)) ++next;
+  if (Return *ret = dynamic_cast<Return*>(*next))
+    return ret->NumSrcs() == 0 ? call->GetDst() == NULL : ret->GetSrc(0) == call->GetDst();
+  return dynamic_cast<EndFunc*>(*next) && call->GetDst() == NULL;
+}
+
+/* Function: EliminateSelfTailCalls
+ * --------------------------------
+ * Turns the self tail calls of the function named label, starting at
+ * the BeginFunc at begin, into jumps to the start of its body.
+ */
+static void EliminateSelfTailCalls(std::list<Instruction*> &code, Position begin,
+                                   const char *label)
+{
+  BeginFunc *beginFunc = dynamic_cast<BeginFunc*>(*begin);
+  std::map<int, Location*> params;              // by offset
+  Position p;
+  for (p = begin; !dynamic_cast<EndFunc*>(*p); ++p)
+    for (int s = -1; s < (*p)->NumSrcs(); s++) {
+      Location *var = s < 0 ? (*p)->GetDst() : (*p)->GetSrc(s);
+      if (IsParameter(var)) params[var->GetOffset()] = var;
+    }
+
+  const char *entry = NULL;
+  for (p = begin; !dynamic_cast<EndFunc*>(*p); ++p) {
+    LCall *call = dynamic_cast<LCall*>(*p);
+    Position next = p;
+    ++next;
+    if (!call || call->IsBuiltIn() || strcmp(call->GetLabel(), label) != 0
+        || !InTailPosition(call, next))
+      continue;
+
+    PopParams *pop = dynamic_cast<PopParams*>(*next);
+    int n = pop ? pop->GetBytes() / CodeGenerator::VarSize : 0;
+    std::vector<Location*> args;                // the first one first
+    Position first = p;
+    for (int a = 0; a < n; a++) {
+      PushParam *push = dynamic_cast<PushParam*>(*--first);
+      Assert(push != NULL);
+      args.push_back(push->GetSrc(0));
+    }
+
+    std::vector<Instruction*> jump;
+    for (int a = 0; a < n; a++) {
+      int offset = (a + 1) * CodeGenerator::VarSize;
+      if (IsParameter(args[a]) && args[a]->GetOffset() != offset && params.count(offset)) {
+        Location *copy = NewVariable(beginFunc, args[a]->GetName());
+        jump.push_back(new Assign(copy, args[a]));
+        args[a] = copy;
+      }
+    }
+    for (int a = 0; a < n; a++) {
+      int offset = (a + 1) * CodeGenerator::VarSize;
+      if (params.count(offset) && args[a] != params[offset])
+        jump.push_back(new Assign(params[offset], args[a]));
+    }
+    if (!entry) {
+      entry = CodeGenerator::NewLabel();
+      Position body = begin;
+      code.insert(++body, new Label(entry));
+    }
+    jump.push_back(new Goto(entry));
+
+    if (pop) ++next;
+    if (dynamic_cast<Return*>(*next)) ++next;   // no longer reached
+    p = code.erase(first, next);
+    code.insert(p, jump.begin(), jump.end());
+    --p;
+  }
+}
+
+void EliminateTailCalls(std::list<Instruction*> &code)
+{
+  Position p, prev = code.end();
+  for (p = code.begin(); p != code.end(); prev = p++) {
+    if (!dynamic_cast<BeginFunc*>(*p)) continue;
+    Label *label = (prev != code.end()) ? dynamic_cast<Label*>(*prev) : NULL;
+    Assert(label != NULL);
+    EliminateSelfTailCalls(code, p, label->text());
+  }
+}
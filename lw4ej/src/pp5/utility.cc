@@ -10,6 +10,9 @@
 #include <string.h>
 
 static List<const char*> debugKeys;
+static int optimizationLevel = 0;
+static List<const char*> passesOn, passesOff, passesNamed;
+static bool timePasses = false;
 static const int BufferSize = 2048;
 
 void Failure(const char *format, ...)
@@ -27,13 +30,18 @@ void Failure(const char *format, ...)
 
 
 
-int IndexOf(const char *key)
+static int IndexIn(List<const char*> &keys, const char *key)
 {
-   for (int i = 0; i < debugKeys.NumElements(); i++)
-      if (!strcmp(debugKeys.Nth(i), key)) return i;
+   for (int i = 0; i < keys.NumElements(); i++)
+      if (!strcmp(keys.Nth(i), key)) return i;
    return -1;
 }
 
+int IndexOf(const char *key)
+{
+   return IndexIn(debugKeys, key);
+}
+
 bool IsDebugOn(const char *key)
 {
    return (IndexOf(key) != -1);
@@ -66,17 +74,69 @@ void PrintDebug(const char *key, const char *format, ...)
 }
 
 
+int GetOptimizationLevel()
+{
+  return optimizationLevel;
+}
+
+
+int GetPassSetting(const char *name)
+{
+  if (IndexIn(passesOn, name) != -1) return 1;
+  if (IndexIn(passesOff, name) != -1) return 0;
+  return -1;
+}
+
+
+List<const char*> *GetPassesNamed()
+{
+  return &passesNamed;
+}
+
+
+bool IsTimePassesOn()
+{
+  return timePasses;
+}
+
+
+static void PrintUsage()
+{
+  printf("Usage:   [-O<level>] [-f<pass> | -fno-<pass> ...] [-time-passes] "
+         "[-d <debug-key-1> <debug-key-2> ...] \n");
+  exit(2);
+}
+
 void ParseCommandLine(int argc, char *argv[])
 {
-  if (argc == 1)
+  int first = 1;
+  for (; first < argc; first++) {
+    const char *arg = argv[first];
+    if (!strncmp(arg, "-O", 2)) { // optimization level, -O alone means -O1
+      char *end;
+      optimizationLevel = arg[2] ? strtol(arg + 2, &end, 10) : 1;
+      if (arg[2] && (*end || optimizationLevel < 0))
+        PrintUsage();
+    } else if (!strcmp(arg, "-time-passes")) {
+      timePasses = true;
+    } else if (!strncmp(arg, "-f", 2)) { // a pass on or off, the last flag wins
+      bool on = strncmp(arg, "-fno-", 5) != 0;
+      const char *name = arg + (on ? 2 : 5);
+      if (!*name) PrintUsage();
+      if (IndexIn(passesNamed, name) == -1) passesNamed.Append(name);
+      int k = IndexIn(on ? passesOff : passesOn, name);
+      if (k != -1) (on ? passesOff : passesOn).RemoveAt(k);
+      if (IndexIn(on ? passesOn : passesOff, name) == -1)
+        (on ? passesOn : passesOff).Append(name);
+    } else
+      break;
+  }
+  if (first == argc)
     return;
   
-  if (strcmp(argv[1], "-d") != 0) { // first arg is not -d
-    printf("Usage:   -d <debug-key-1> <debug-key-2> ... \n");
-    exit(2);
-  }
+  if (strcmp(argv[first], "-d") != 0) // next arg is not -d
+    PrintUsage();
 
-  for (int i = 2; i < argc; i++)
+  for (int i = first + 1; i < argc; i++)
     SetDebugForKey(argv[i], true);
 }
-
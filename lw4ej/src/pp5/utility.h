@@ -10,6 +10,8 @@
 #include <stdlib.h>
 #include <stdio.h>
 
+template<class Element> class List;
+
 
 /* Function: Failure()
  * Usage: Failure("Out of memory!");
@@ -72,11 +74,52 @@ bool IsDebugOn(const char *key);
 
 
 
+/* Function: GetOptimizationLevel()
+ * Usage: if (GetOptimizationLevel() > 0) ...
+ * ------------------------------------------
+ * Return the optimization level requested on the command line with
+ * -O<level>. Level 0 (the default) is the simple translation that
+ * keeps every variable in memory.
+ */
+int GetOptimizationLevel();
+
+
+
+/* Function: GetPassSetting()
+ * Usage: int on = GetPassSetting("inline");
+ * -----------------------------------------
+ * Return 1 if the optimization pass with the given name was turned on
+ * on the command line with -f<name>, 0 if it was turned off with
+ * -fno-<name>, and -1 if neither (the -O level decides).
+ */
+int GetPassSetting(const char *name);
+
+
+/* Function: GetPassesNamed()
+ * Usage: List<const char*> *names = GetPassesNamed();
+ * ---------------------------------------------------
+ * Return the names given with -f<name> and -fno-<name> on the command
+ * line, each once, for the optimizer to check they name passes.
+ */
+List<const char*> *GetPassesNamed();
+
+
+/* Function: IsTimePassesOn()
+ * Usage: if (IsTimePassesOn()) ...
+ * --------------------------------
+ * Return true if -time-passes asked for a report of the time and the
+ * change in Tac size of each optimization pass.
+ */
+bool IsTimePassesOn();
+
+
+
 /* Function: ParseCommandLine
  * --------------------------
- * Turn on the debugging flags from the command line.  Verifies that
- * first argument is -d, and then interpret all the arguments that follow
- * as being flags to turn on.
+ * Turn on the debugging flags from the command line.  Accepts
+ * optional -O<level>, -f<pass>, -fno-<pass> and -time-passes flags,
+ * then verifies that the next argument (if any) is -d, and interprets
+ * all the arguments that follow as being flags to turn on.
  */
 void ParseCommandLine(int argc, char *argv[]);
      
@@ -0,0 +1,232 @@
+/* File: valnum.cc
+ * ---------------
+ * Dominator-based value numbering (Briggs, Cooper and Simpson) on SSA
+ * form. The blocks are visited in a walk of the dominator tree with a
+ * table of the computations available so far: those of the block's
+ * dominators, which are sure to have run whenever the block runs. An
+ * instruction computing what the table already holds is redundant, and
+ * the variable holding the earlier result is read in place of its own.
+ * When the walk leaves a block, what the block added to the table is
+ * taken back out.
+ *
+ * BinaryOp and LoadLabel always compute the same value from the same
+ * operands. A Load does so only while memory isn't changed in between,
+ * so Stores and calls take the loads they may change (see memory.cc)
+ * out of the table, and a block whose dominator's loads may have been
+ * changed on the way to it (by a Store or call in the blocks in
+ * between, or in a loop back to it) starts with those taken out. A
+ * Store makes its value available to loads from the same address.
+ */
+
+#include "optimize.h"
+#include <set>
+#include <string>
+
+
+class ValueNumbering
+{
+  public:
+    ValueNumbering(FlowGraph *graph);
+    void Run();
+
+  private:
+    typedef enum { Binary, Label, Memory } Kind;
+    struct Expr {
+      Kind kind;
+      int code;                 // BinaryOp opcode
+      Location *a, *b;          // operands (the base for Memory)
+      int imm;                  // immediate operand or Load offset
+      std::string label;
+      Expr() : kind(Binary), code(0), a(NULL), b(NULL), imm(0) {}
+      bool operator<(const Expr &e) const;
+    };
+
+    FlowGraph *graph;
+    MemoryModel memory;
+    std::map<Location*, Location*> number;      // var -> earlier equal var
+    std::map<Expr, Location*> available;
+    std::vector<std::pair<Expr, Location*> > undo;  // previous value or NULL
+    std::set<Instruction*> redundant;
+
+    Location *Number(Location *var);
+    void Set(const Expr &e, Location *value);
+    void Kill(Instruction *clobber);
+    bool ExprFor(Instruction *instr, Expr *e);
+    void KillOnWayTo(BasicBlock *b);
+    void Visit(BasicBlock *b);
+};
+
+bool ValueNumbering::Expr::operator<(const Expr &e) const
+{
+  if (kind != e.kind) return kind < e.kind;
+  if (code != e.code) return code < e.code;
+  if (a != e.a) return a < e.a;
+  if (b != e.b) return b < e.b;
+  if (imm != e.imm) return imm < e.imm;
+  return label < e.label;
+}
+
+ValueNumbering::ValueNumbering(FlowGraph *g) : graph(g), memory(g) {}
+
+Location *ValueNumbering::Number(Location *var)
+{
+  std::map<Location*, Location*>::iterator it;
+  while ((it = number.find(var)) != number.end())
+    var = it->second;
+  return var;
+}
+
+void ValueNumbering::Set(const Expr &e, Location *value)
+{
+  std::map<Expr, Location*>::iterator it = available.find(e);
+  undo.push_back(std::make_pair(e, it == available.end() ? (Location*)NULL : it->second));
+  if (value)
+    available[e] = value;
+  else if (it != available.end())
+    available.erase(it);
+}
+
+// Takes out of the table the loads the Store or call might overwrite.
+void ValueNumbering::Kill(Instruction *clobber)
+{
+  std::vector<Expr> killed;
+  std::map<Expr, Location*>::iterator it;
+  for (it = available.begin(); it != available.end(); ++it)
+    if (it->first.kind == Memory && memory.MayChange(clobber, it->first.a, it->first.imm))
+      killed.push_back(it->first);
+  for (int i = 0; i < killed.size(); i++)
+    Set(killed[i], NULL);
+}
+
+// A global, not in SSA form, may hold a different value at each read,
+// so only what is computed from renamed variables has a number.
+bool ValueNumbering::ExprFor(Instruction *instr, Expr *e)
+{
+  if (!SSA::IsRenamed(instr->GetDst())) return false;
+  for (int s = 0; s < instr->NumSrcs(); s++)
+    if (!SSA::IsRenamed(instr->GetSrc(s))) return false;
+  if (BinaryOp *op = dynamic_cast<BinaryOp*>(instr)) {
+    e->kind = Binary;
+    e->code = op->GetOpCode();
+    e->a = Number(op->GetSrc(0));
+    if (op->HasImmediate())
+      e->imm = op->GetImmediate();
+    else
+      e->b = Number(op->GetSrc(1));
+    if (e->b && e->b < e->a && (e->code == BinaryOp::Add || e->code == BinaryOp::Mul
+        || e->code == BinaryOp::Eq || e->code == BinaryOp::And || e->code == BinaryOp::Or
+        || e->code == BinaryOp::AddU))
+      std::swap(e->a, e->b);
+    return true;
+  }
+  if (Load *load = dynamic_cast<Load*>(instr)) {
+    e->kind = Memory;
+    e->a = Number(load->GetSrc(0));
+    e->imm = load->GetOffset();
+    return true;
+  }
+  if (LoadLabel *ll = dynamic_cast<LoadLabel*>(instr)) {
+    e->kind = Label;
+    e->label = ll->GetLabel();
+    return true;
+  }
+  return false;
+}
+
+// Kills what the Stores and calls in the blocks between b's immediate
+// dominator and b might overwrite: the blocks reaching b without going
+// through the dominator, b itself included if it is in a loop.
+void ValueNumbering::KillOnWayTo(BasicBlock *b)
+{
+  std::vector<bool> seen(graph->blocks.size(), false);
+  std::vector<BasicBlock*> work;
+  for (int p = 0; p < b->preds.size(); p++)
+    if (b->preds[p] != b->idom) work.push_back(b->preds[p]);
+  while (!work.empty()) {
+    BasicBlock *between = work.back();
+    work.pop_back();
+    if (seen[between->id]) continue;
+    seen[between->id] = true;
+    for (int i = 0; i < between->code.size(); i++)
+      if (MemoryModel::ChangesMemory(between->code[i]))
+        Kill(between->code[i]);
+    for (int p = 0; p < between->preds.size(); p++)
+      if (between->preds[p] != b->idom) work.push_back(between->preds[p]);
+  }
+}
+
+void ValueNumbering::Visit(BasicBlock *b)
+{
+  int mark = undo.size();
+  if (b->idom) KillOnWayTo(b);
+
+  std::map<std::vector<Location*>, Location*> phis;
+  for (int i = 0; i < b->code.size(); i++) {
+    Instruction *instr = b->code[i];
+    if (dynamic_cast<Phi*>(instr)) {
+      std::vector<Location*> args;
+      for (int s = 0; s < instr->NumSrcs(); s++)
+        args.push_back(Number(instr->GetSrc(s)));
+      if (phis.count(args)) {
+        number[instr->GetDst()] = phis[args];
+        redundant.insert(instr);
+      } else
+        phis[args] = instr->GetDst();
+      continue;
+    }
+    Expr e;
+    if (ExprFor(instr, &e)) {
+      std::map<Expr, Location*>::iterator it = available.find(e);
+      if (it != available.end()) {
+        number[instr->GetDst()] = it->second;
+        redundant.insert(instr);
+      } else
+        Set(e, instr->GetDst());
+    } else if (MemoryModel::ChangesMemory(instr)) {
+      Kill(instr);
+      Store *store = dynamic_cast<Store*>(instr);
+      if (store && SSA::IsRenamed(store->GetSrc(0)) && SSA::IsRenamed(store->GetSrc(1))) {
+        e.kind = Memory;                    // a load from there gets the value
+        e.a = Number(store->GetSrc(0));
+        e.imm = store->GetOffset();
+        Set(e, Number(store->GetSrc(1)));
+      }
+    }
+  }
+
+  for (int c = 0; c < b->domChildren.size(); c++)
+    Visit(b->domChildren[c]);
+
+  while (undo.size() > mark) {
+    if (undo.back().second)
+      available[undo.back().first] = undo.back().second;
+    else
+      available.erase(undo.back().first);
+    undo.pop_back();
+  }
+}
+
+void ValueNumbering::Run()
+{
+  Visit(graph->Entry());
+  if (redundant.empty()) return;
+  std::vector<BasicBlock*> &blocks = graph->blocks;
+  for (int b = 0; b < blocks.size(); b++) {
+    std::vector<Instruction*> &code = blocks[b]->code;
+    for (int i = 0; i < code.size(); i++) {
+      if (redundant.count(code[i])) {
+        code.erase(code.begin() + i--);
+        continue;
+      }
+      for (int s = 0; s < code[i]->NumSrcs(); s++)
+        if (number.count(code[i]->GetSrc(s)))
+          code[i]->SetSrc(s, Number(code[i]->GetSrc(s)));
+    }
+  }
+}
+
+void NumberValues(FlowGraph *graph)
+{
+  ValueNumbering pass(graph);
+  pass.Run();
+}